@@ -0,0 +1,526 @@
+/**
+ * Benchmark of the backend stages on synthetic affinity volumes.
+ *
+ * Times watershed(), get_region_graph(), mergeUntil() for each scoring
+ * function and queue, extractSegmentation(), and compare_volumes() separately.
+ * Each measurement is written as one JSON object per line.
+ *
+ * Usage:
+ *
+ *   waterz_benchmark [--size N] [--volume noise|voronoi|replay|all]
+ *                    [--replay FILE] [--cell-size S] [--seed SEED]
+ *                    [--filter NAME] [--output FILE]
+ *
+ * The replay volume has the structure of the voronoi volume, but its
+ * affinities are rank-matched to the distribution of the affinities in FILE (a
+ * raw array of float32 values, e.g., written with numpy's tofile()).
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include <IterativeRegionMerging.hpp>
+#include <SingleLinkageMerging.hpp>
+#include <MergeFunctions.hpp>
+#include <Operators.hpp>
+#include <BinQueue.hpp>
+#include <PriorityQueue.hpp>
+#include <ScoringExpression.hpp>
+#include <basic_watershed.hpp>
+#include <region_graph.hpp>
+#include <evaluate.hpp>
+
+typedef uint64_t SegID;
+typedef uint32_t GtID;
+typedef float AffValue;
+typedef float ScoreValue;
+typedef RegionGraph<SegID> RegionGraphType;
+
+template <typename T, typename S>
+using BinQueue256 = BinQueue<T, S, 256>;
+
+struct Options {
+
+	std::size_t size     = 64;
+	std::string volume   = "all";
+	std::string replay;
+	std::size_t cellSize = 8;
+	unsigned    seed     = 42;
+	std::string filter;
+	std::string output;
+};
+
+struct Volume {
+
+	std::string              name;
+	affinity_graph<AffValue> affinities;
+	volume<GtID>             groundTruth;
+};
+
+struct Record {
+
+	std::string volume;
+	std::string stage;
+	std::string scoringFunction;
+	std::string queue;
+	std::size_t voxels = 0;
+	std::size_t edges  = 0;
+	std::size_t merges = 0;
+	double      seconds = 0;
+	double      cpuSeconds = 0;
+};
+
+class Timer {
+
+public:
+
+	Timer() :
+		_wall(std::chrono::steady_clock::now()),
+		_cpu(std::clock()) {}
+
+	double seconds() const {
+
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - _wall).count();
+	}
+
+	double cpuSeconds() const {
+
+		return double(std::clock() - _cpu)/CLOCKS_PER_SEC;
+	}
+
+private:
+
+	std::chrono::steady_clock::time_point _wall;
+	std::clock_t _cpu;
+};
+
+/**
+ * Peak resident set size of the process so far, in kilobytes.
+ */
+long peakRss() {
+
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+/**
+ * Write a record as a single line of JSON.
+ */
+void report(std::ostream& out, const Options& options, const Record& record, const Timer& timer) {
+
+	Record r = record;
+	r.seconds = timer.seconds();
+	r.cpuSeconds = timer.cpuSeconds();
+
+	auto rate = [&r](std::size_t n) { return r.seconds > 0 ? n/r.seconds : 0.0; };
+
+	out
+		<< "{\"volume\": \"" << r.volume << "\""
+		<< ", \"size\": " << options.size
+		<< ", \"stage\": \"" << r.stage << "\""
+		<< ", \"scoring_function\": \"" << r.scoringFunction << "\""
+		<< ", \"queue\": \"" << r.queue << "\""
+		<< ", \"seconds\": " << r.seconds
+		<< ", \"cpu_seconds\": " << r.cpuSeconds
+		<< ", \"voxels\": " << r.voxels
+		<< ", \"edges\": " << r.edges
+		<< ", \"merges\": " << r.merges
+		<< ", \"voxels_per_s\": " << rate(r.voxels)
+		<< ", \"edges_per_s\": " << rate(r.edges)
+		<< ", \"merges_per_s\": " << rate(r.merges)
+		<< ", \"peak_rss_kb\": " << peakRss()
+		<< "}" << std::endl;
+}
+
+/**
+ * Visitor counting the merges.
+ */
+class CountingVisitor {
+
+public:
+
+	CountingVisitor() : merges(0) {}
+
+	template <typename EdgeIdType, typename ScoreType>
+	void onPop(EdgeIdType, ScoreType) {}
+
+	template <typename EdgeIdType>
+	void onDeletedEdgeFound(EdgeIdType) {}
+
+	template <typename EdgeIdType, typename ScoreType>
+	void onStaleEdgeFound(EdgeIdType, ScoreType, ScoreType) {}
+
+	template <typename EdgeIdType, typename ScoreType>
+	void onPutBack(EdgeIdType, ScoreType) {}
+
+	template <typename EdgeIdType, typename NodeIdType, typename ScoreType>
+	void onMerge(EdgeIdType, NodeIdType, NodeIdType, NodeIdType, ScoreType) { merges++; }
+
+	std::size_t merges;
+};
+
+/**
+ * Uniform random affinities without any structure.
+ */
+Volume noiseVolume(const Options& options, std::mt19937& random) {
+
+	std::size_t n = options.size;
+	std::uniform_real_distribution<AffValue> uniform(0, 1);
+
+	Volume v;
+	v.name = "noise";
+	v.affinities.resize(boost::extents[3][n][n][n]);
+	v.groundTruth.resize(boost::extents[n][n][n]);
+
+	for (std::size_t i = 0; i < v.affinities.num_elements(); i++)
+		v.affinities.data()[i] = uniform(random);
+	for (std::size_t i = 0; i < v.groundTruth.num_elements(); i++)
+		v.groundTruth.data()[i] = 1 + random()%16;
+
+	return v;
+}
+
+/**
+ * Voronoi cells around jittered grid points. Affinities are high within cells
+ * and low across cell boundaries, with additive noise.
+ */
+Volume voronoiVolume(const Options& options, std::mt19937& random) {
+
+	std::size_t n = options.size;
+	std::size_t s = options.cellSize;
+	std::size_t cells = (n + s - 1)/s;
+
+	std::uniform_real_distribution<float> uniform(0, 1);
+	std::normal_distribution<float> noise(0, 0.1);
+
+	// one seed point per grid cell
+	std::vector<float> seeds(cells*cells*cells*3);
+	for (std::size_t c = 0; c < cells*cells*cells; c++) {
+
+		std::size_t cz = c/(cells*cells);
+		std::size_t cy = (c/cells)%cells;
+		std::size_t cx = c%cells;
+		seeds[c*3 + 0] = (cz + uniform(random))*s;
+		seeds[c*3 + 1] = (cy + uniform(random))*s;
+		seeds[c*3 + 2] = (cx + uniform(random))*s;
+	}
+
+	Volume v;
+	v.name = "voronoi";
+	v.affinities.resize(boost::extents[3][n][n][n]);
+	v.groundTruth.resize(boost::extents[n][n][n]);
+
+	// assign each voxel to the closest seed in the neighboring grid cells
+	for (std::ptrdiff_t z = 0; z < (std::ptrdiff_t)n; z++)
+		for (std::ptrdiff_t y = 0; y < (std::ptrdiff_t)n; y++)
+			for (std::ptrdiff_t x = 0; x < (std::ptrdiff_t)n; x++) {
+
+				float minDistance = std::numeric_limits<float>::max();
+				GtID closest = 0;
+
+				for (std::ptrdiff_t dz = -1; dz <= 1; dz++)
+					for (std::ptrdiff_t dy = -1; dy <= 1; dy++)
+						for (std::ptrdiff_t dx = -1; dx <= 1; dx++) {
+
+							std::ptrdiff_t cz = z/s + dz;
+							std::ptrdiff_t cy = y/s + dy;
+							std::ptrdiff_t cx = x/s + dx;
+							if (cz < 0 || cy < 0 || cx < 0 ||
+							    cz >= (std::ptrdiff_t)cells ||
+							    cy >= (std::ptrdiff_t)cells ||
+							    cx >= (std::ptrdiff_t)cells)
+								continue;
+
+							std::size_t c = (cz*cells + cy)*cells + cx;
+							float d =
+									std::pow(seeds[c*3 + 0] - z, 2) +
+									std::pow(seeds[c*3 + 1] - y, 2) +
+									std::pow(seeds[c*3 + 2] - x, 2);
+
+							if (d < minDistance) {
+
+								minDistance = d;
+								closest = c + 1;
+							}
+						}
+
+				v.groundTruth[z][y][x] = closest;
+			}
+
+	// affinities between each voxel and its predecessor along each axis
+	for (std::size_t z = 0; z < n; z++)
+		for (std::size_t y = 0; y < n; y++)
+			for (std::size_t x = 0; x < n; x++)
+				for (int d = 0; d < 3; d++) {
+
+					std::size_t p[3] = {z, y, x};
+					float affinity = 0;
+
+					if (p[d] > 0) {
+
+						p[d]--;
+						bool same = v.groundTruth[z][y][x] == v.groundTruth[p[0]][p[1]][p[2]];
+						affinity = (same ? 0.9 : 0.1) + noise(random);
+					}
+
+					v.affinities[d][z][y][x] = std::min(1.0f, std::max(0.0f, affinity));
+				}
+
+	return v;
+}
+
+/**
+ * The voronoi volume with its affinities rank-matched to the distribution of
+ * recorded affinities.
+ */
+Volume replayVolume(const Options& options, std::mt19937& random) {
+
+	std::ifstream in(options.replay, std::ios::binary);
+	if (!in)
+		throw std::runtime_error("can not open replay file " + options.replay);
+
+	std::vector<AffValue> recorded;
+	AffValue value;
+	while (in.read(reinterpret_cast<char*>(&value), sizeof(AffValue)))
+		recorded.push_back(value);
+
+	if (recorded.empty())
+		throw std::runtime_error("replay file " + options.replay + " is empty");
+
+	std::sort(recorded.begin(), recorded.end());
+
+	Volume v = voronoiVolume(options, random);
+	v.name = "replay";
+
+	std::size_t num = v.affinities.num_elements();
+	AffValue* data = v.affinities.data();
+
+	// replace the k-th smallest synthetic affinity with the recorded affinity
+	// at the same quantile
+	std::vector<std::size_t> order(num);
+	for (std::size_t i = 0; i < num; i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [data](std::size_t a, std::size_t b) { return data[a] < data[b]; });
+
+	for (std::size_t k = 0; k < num; k++)
+		data[order[k]] = recorded[k*recorded.size()/num];
+
+	return v;
+}
+
+template <typename ProviderType>
+void configure(ProviderType&, const ScoringExpression&) {}
+
+void configure(ExpressionStatisticsProvider<RegionGraphType, ScoreValue>& provider, const ScoringExpression& expression) {
+
+	provider.configure(expression);
+}
+
+/**
+ * Benchmark region graph extraction, merging, and segmentation extraction for
+ * one scoring function and region merging (i.e., queue).
+ */
+template <typename ScoringFunctionType, typename RegionMergingType>
+void benchmark(
+		std::ostream& out,
+		const Options& options,
+		const Volume& input,
+		const volume<SegID>& fragments,
+		std::size_t numNodes,
+		const std::string& scoringFunctionName,
+		const std::string& queueName,
+		const std::string& expression = "") {
+
+	if (!options.filter.empty() && scoringFunctionName.find(options.filter) == std::string::npos)
+		return;
+
+	typedef typename ScoringFunctionType::StatisticsProviderType StatisticsProviderType;
+
+	Record record;
+	record.volume = input.name;
+	record.scoringFunction = scoringFunctionName;
+	record.queue = queueName;
+	record.voxels = fragments.num_elements();
+
+	// the statistics are collected while extracting the region graph
+	RegionGraphType regionGraph(numNodes);
+	StatisticsProviderType statisticsProvider(regionGraph);
+	configure(statisticsProvider, ScoringExpression(expression.empty() ? "0" : expression));
+
+	{
+		Timer timer;
+		get_region_graph(input.affinities, fragments, numNodes - 1, statisticsProvider, regionGraph);
+		record.stage = "region_graph";
+		record.edges = regionGraph.edges().size();
+		report(out, options, record, timer);
+	}
+
+	ScoringFunctionType scoringFunction(regionGraph, statisticsProvider);
+	RegionMergingType regionMerging(regionGraph);
+
+	{
+		CountingVisitor visitor;
+		Timer timer;
+		regionMerging.mergeUntil(
+				scoringFunction,
+				statisticsProvider,
+				std::numeric_limits<ScoreValue>::max(),
+				visitor);
+		record.stage = "merge";
+		record.merges = visitor.merges;
+		report(out, options, record, timer);
+	}
+
+	{
+		volume<SegID> segmentation(fragments);
+		Timer timer;
+		regionMerging.extractSegmentation(segmentation);
+		record.stage = "extract_segmentation";
+		record.edges = 0;
+		record.merges = 0;
+		report(out, options, record, timer);
+	}
+}
+
+template <typename ScoringFunctionType>
+void benchmarkQueues(
+		std::ostream& out,
+		const Options& options,
+		const Volume& input,
+		const volume<SegID>& fragments,
+		std::size_t numNodes,
+		const std::string& scoringFunctionName,
+		bool normalized,
+		const std::string& expression = "") {
+
+	typedef IterativeRegionMerging<SegID, ScoreValue, PriorityQueue> PriorityQueueMerging;
+	typedef IterativeRegionMerging<SegID, ScoreValue, BinQueue256>   BinQueueMerging;
+	typedef SingleLinkageMerging<SegID, ScoreValue>                  KruskalMerging;
+
+	benchmark<ScoringFunctionType, PriorityQueueMerging>(out, options, input, fragments, numNodes, scoringFunctionName, "pq", expression);
+
+	// the bin queue assumes scores in [0,1]
+	if (normalized)
+		benchmark<ScoringFunctionType, BinQueueMerging>(out, options, input, fragments, numNodes, scoringFunctionName, "bq256", expression);
+
+	if (IsSingleLinkage<ScoringFunctionType>::value)
+		benchmark<ScoringFunctionType, KruskalMerging>(out, options, input, fragments, numNodes, scoringFunctionName, "single_linkage", expression);
+}
+
+void benchmarkVolume(std::ostream& out, const Options& options, const Volume& input) {
+
+	std::size_t n = options.size;
+
+	Record record;
+	record.volume = input.name;
+	record.voxels = n*n*n;
+
+	volume<SegID> fragments(boost::extents[n][n][n]);
+	counts_t<std::size_t> sizes;
+
+	{
+		Timer timer;
+		watershed(input.affinities, 0.0001f, 0.9999f, fragments, sizes);
+		record.stage = "watershed";
+		report(out, options, record, timer);
+	}
+
+	std::size_t numNodes = sizes.size();
+
+	{
+		Timer timer;
+		compare_volumes(input.groundTruth, fragments);
+		record.stage = "compare_volumes";
+		report(out, options, record, timer);
+	}
+
+	typedef RegionGraphType RG;
+
+	benchmarkQueues<OneMinus<MeanAffinity<RG, ScoreValue>>>(out, options, input, fragments, numNodes, "mean", true);
+	benchmarkQueues<OneMinus<MaxAffinity<RG, ScoreValue>>>(out, options, input, fragments, numNodes, "max", true);
+	benchmarkQueues<OneMinus<MinAffinity<RG, ScoreValue>>>(out, options, input, fragments, numNodes, "min", true);
+	benchmarkQueues<OneMinus<HistogramQuantileAffinity<RG, 50, ScoreValue, 256>>>(out, options, input, fragments, numNodes, "histogram_quantile50", true);
+	benchmarkQueues<OneMinus<QuantileAffinity<RG, 50, ScoreValue>>>(out, options, input, fragments, numNodes, "vector_quantile50", true);
+	benchmarkQueues<OneMinus<MeanMaxKAffinity<RG, 10, ScoreValue>>>(out, options, input, fragments, numNodes, "meanmax10", true);
+	benchmarkQueues<ContactArea<RG>>(out, options, input, fragments, numNodes, "contact_area", false);
+	benchmarkQueues<MinSize<RG>>(out, options, input, fragments, numNodes, "min_size", false);
+	benchmarkQueues<MaxSize<RG>>(out, options, input, fragments, numNodes, "max_size", false);
+	benchmarkQueues<Multiply<OneMinus<MeanAffinity<RG, ScoreValue>>, MinSize<RG>>>(out, options, input, fragments, numNodes, "mean_min_size", false);
+	benchmarkQueues<Random<RG>>(out, options, input, fragments, numNodes, "random", true);
+	benchmarkQueues<Constant<RG, 0>>(out, options, input, fragments, numNodes, "constant", true);
+	benchmarkQueues<ExpressionScore<RG, ScoreValue>>(out, options, input, fragments, numNodes, "expression_mean", true, "1 - mean(aff)");
+}
+
+int main(int argc, char** argv) {
+
+	Options options;
+
+	for (int i = 1; i < argc; i++) {
+
+		std::string arg = argv[i];
+		if (i + 1 >= argc) {
+
+			std::cerr << "missing value for " << arg << std::endl;
+			return 1;
+		}
+
+		std::string value = argv[++i];
+
+		if (arg == "--size")
+			options.size = std::stoul(value);
+		else if (arg == "--volume")
+			options.volume = value;
+		else if (arg == "--replay")
+			options.replay = value;
+		else if (arg == "--cell-size")
+			options.cellSize = std::stoul(value);
+		else if (arg == "--seed")
+			options.seed = std::stoul(value);
+		else if (arg == "--filter")
+			options.filter = value;
+		else if (arg == "--output")
+			options.output = value;
+		else {
+
+			std::cerr << "unknown argument " << arg << std::endl;
+			return 1;
+		}
+	}
+
+	std::ofstream file;
+	if (!options.output.empty())
+		file.open(options.output);
+	std::ostream out(options.output.empty() ? std::cout.rdbuf() : file.rdbuf());
+
+	std::mt19937 random(options.seed);
+
+	try {
+
+		if (options.volume == "noise" || options.volume == "all")
+			benchmarkVolume(out, options, noiseVolume(options, random));
+		if (options.volume == "voronoi" || options.volume == "all")
+			benchmarkVolume(out, options, voronoiVolume(options, random));
+		if (options.volume == "replay" || (options.volume == "all" && !options.replay.empty()))
+			benchmarkVolume(out, options, replayVolume(options, random));
+
+	} catch (const std::exception& e) {
+
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
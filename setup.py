@@ -3,6 +3,8 @@ from setuptools.extension import Extension
 from setuptools.command.build_ext import build_ext as _build_ext
 from Cython.Build import cythonize
 import os
+import runpy
+import shutil
 import builtins
 
 VERSION = '0.9.6'
@@ -24,6 +26,9 @@ class build_ext(_build_ext):
         builtins.__NUMPY_SETUP__ = False
         import numpy
         self.include_dirs.append(numpy.get_include())
+        # the prebuilt agglomerate modules are independent of each other
+        if self.parallel is None:
+            self.parallel = os.cpu_count()
 
 
 source_dir = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'waterz')
@@ -40,10 +45,61 @@ extensions = [
         include_dirs=include_dirs,
         language='c++',
         extra_link_args=['-std=c++11'],
+        extra_compile_args=['-std=c++11', '-w']),
+    Extension(
+        'waterz.cut',
+        sources=['waterz/cut.pyx', 'waterz/frontend_cut.cpp'],
+        include_dirs=include_dirs,
+        language='c++',
+        extra_link_args=['-std=c++11'],
         extra_compile_args=['-std=c++11', '-w'])
 ]
 
 
+def prebuilt_extensions():
+    """Agglomerate modules for common scoring functions, see
+    waterz/prebuilt.py. Set WATERZ_NO_PREBUILT=1 to skip them (e.g., for
+    faster development builds).
+    """
+
+    if os.environ.get('WATERZ_NO_PREBUILT', '0') != '0':
+        return []
+
+    prebuilt = runpy.run_path(os.path.join(source_dir, 'prebuilt.py'))
+
+    extensions = []
+    for module_name, scoring_function, discretize_queue in prebuilt['variants']():
+
+        # each variant gets its own copy of the sources (cython requires that
+        # the pyx file has the same name as the module) and headers
+        variant_dir = os.path.join('build', 'prebuilt', module_name)
+        os.makedirs(variant_dir, exist_ok=True)
+
+        with open(os.path.join(variant_dir, 'ScoringFunction.h'), 'w') as f:
+            f.write(prebuilt['scoring_function_header'](scoring_function))
+        with open(os.path.join(variant_dir, 'Queue.h'), 'w') as f:
+            f.write(prebuilt['queue_header'](discretize_queue))
+
+        pyx = os.path.join(variant_dir, module_name + '.pyx')
+        cpp = os.path.join(variant_dir, 'frontend_agglomerate.cpp')
+        shutil.copy(os.path.join(source_dir, 'agglomerate.pyx'), pyx)
+        shutil.copy(os.path.join(source_dir, 'frontend_agglomerate.cpp'), cpp)
+
+        extensions.append(
+            Extension(
+                'waterz.' + module_name,
+                sources=[pyx, cpp],
+                include_dirs=[variant_dir] + include_dirs,
+                language='c++',
+                extra_link_args=['-std=c++11', '-pthread'],
+                extra_compile_args=['-std=c++11', '-w', '-pthread']))
+
+    return extensions
+
+
+extensions += prebuilt_extensions()
+
+
 setup(
     name='waterz',
     version=VERSION,
@@ -0,0 +1,680 @@
+import os
+import subprocess
+import sys
+import numpy as np
+import waterz as wz
+from math import isclose
+
+
+def random_affinities(shape=(10, 20, 20)):
+    # make the random value consistent with different runs
+    np.random.seed(0)
+    return np.random.rand(3, *shape).astype(np.float32)
+
+
+def test_agglomerate_metrics():
+    affs = random_affinities()
+    gt = np.random.randint(1, 10, size=affs.shape[1:]).astype(np.uint32)
+
+    thresholds = [0.1, 0.3, 0.5, 0.7, 0.9]
+    for segmentation, metrics in wz.agglomerate(affs, thresholds, gt=gt):
+
+        # metrics are tracked incrementally, they should agree with evaluating
+        # the segmentation from scratch
+        scores = wz.evaluate(segmentation, gt.astype(np.uint64))
+        assert isclose(metrics['V_Rand_split'], scores['rand_split'])
+        assert isclose(metrics['V_Rand_merge'], scores['rand_merge'])
+        assert isclose(metrics['V_Info_split'], scores['voi_split'], abs_tol=1e-9)
+        assert isclose(metrics['V_Info_merge'], scores['voi_merge'], abs_tol=1e-9)
+
+
+def test_evaluate_merge_curve():
+    affs = random_affinities()
+    gt = np.random.randint(1, 10, size=affs.shape[1:]).astype(np.uint32)
+
+    curve = wz.evaluate_merge_curve(affs, gt)
+    num_merges = len(curve['score'])
+    assert num_merges > 0
+    for key in ['V_Rand_split', 'V_Rand_merge', 'V_Info_split', 'V_Info_merge']:
+        assert len(curve[key]) == num_merges
+
+    # after the last merge, the metrics should agree with a single threshold
+    # that merges everything
+    segmentation, metrics = next(wz.agglomerate(affs, [np.inf], gt=gt))
+    for key in ['V_Rand_split', 'V_Rand_merge', 'V_Info_split', 'V_Info_merge']:
+        assert isclose(curve[key][-1], metrics[key], abs_tol=1e-9)
+
+
+def test_merge_history_and_region_graph():
+    affs = random_affinities()
+
+    thresholds = [0.3, 0.6]
+    results = wz.agglomerate(
+        affs,
+        thresholds,
+        return_merge_history=True,
+        return_region_graph=True)
+
+    for segmentation, merge_history, region_graph in results:
+
+        assert merge_history.dtype.names == ('a', 'b', 'c', 'score')
+        assert region_graph.dtype.names == ('u', 'v', 'score')
+        assert np.all(merge_history['score'] < thresholds[-1])
+
+        # regions in the region graph are the ones in the segmentation
+        ids = np.unique(segmentation)
+        assert np.all(np.isin(region_graph['u'], ids))
+        assert np.all(np.isin(region_graph['v'], ids))
+
+
+def test_region_graph_extraction():
+    affs = random_affinities()
+
+    # blocks with long runs along x, and some background
+    z, y, x = np.indices(affs.shape[1:])
+    fragments = (1 + x//7 + 3*(y//5) + 12*(z//4)).astype(np.uint64)
+    fragments[:, :3, :] = 0
+
+    # mean affinities between fragments, where affs[d] connects each voxel
+    # to its predecessor along axis d
+    expected = {}
+    for d in range(3):
+        cur = [slice(None)]*3
+        prev = [slice(None)]*3
+        cur[d] = slice(1, None)
+        prev[d] = slice(None, -1)
+        for a, b, aff in zip(
+                fragments[tuple(cur)].ravel(),
+                fragments[tuple(prev)].ravel(),
+                affs[d][tuple(cur)].ravel()):
+            if a != b and a != 0 and b != 0:
+                expected.setdefault((min(a, b), max(a, b)), []).append(aff)
+
+    _, region_graph = next(wz.agglomerate(
+        affs,
+        [0],
+        fragments=fragments.copy(),
+        return_region_graph=True))
+
+    assert len(region_graph) == len(expected)
+    for u, v, score in region_graph:
+        assert isclose(score, 1 - np.mean(expected[(u, v)]), abs_tol=1e-5)
+
+
+def test_watershed_region_graph():
+    affs = random_affinities()
+    thresholds = [0.3, 0.6]
+
+    # region graph extracted during the watershed, and from the fragments
+    fragments = next(wz.agglomerate(affs, [0])).copy()
+    for scoring in [{}, {'scoring_expression': '(1 - mean(aff)) * min(min_size, 20)'}]:
+
+        expected = [
+            s.copy()
+            for s in wz.agglomerate(affs, thresholds, fragments=fragments.copy(), **scoring)
+        ]
+        results = [s.copy() for s in wz.agglomerate(affs, thresholds, **scoring)]
+
+        for e, r in zip(expected, results):
+            assert np.array_equal(e, r)
+
+
+def test_agglomerate_threads():
+    from concurrent.futures import ThreadPoolExecutor
+
+    affs = random_affinities()
+
+    def run(threshold):
+        return [s.copy() for s in wz.agglomerate(affs, [threshold])][0]
+
+    thresholds = [0.2, 0.4, 0.6, 0.8]
+    expected = [run(t) for t in thresholds]
+
+    # the GIL is released while agglomerating, contexts are used concurrently
+    with ThreadPoolExecutor(max_workers=4) as executor:
+        results = list(executor.map(run, thresholds))
+
+    for e, r in zip(expected, results):
+        assert np.array_equal(e, r)
+
+
+def test_scoring_expression():
+    affs = random_affinities()
+
+    # an expression gives the same result as the equivalent compiled scoring
+    # function
+    thresholds = [0.2, 0.5, 0.8]
+    expected = [
+        s.copy()
+        for s in wz.agglomerate(
+            affs,
+            thresholds,
+            scoring_function='OneMinus<HistogramQuantileAffinity<RegionGraphType, 75, ScoreValue, 256>>')
+    ]
+    results = [
+        s.copy()
+        for s in wz.agglomerate(
+            affs,
+            thresholds,
+            scoring_expression='1 - quantile75(aff)')
+    ]
+    for e, r in zip(expected, results):
+        assert np.array_equal(e, r)
+
+    try:
+        next(wz.agglomerate(affs, thresholds, scoring_expression='1 - foo(aff)'))
+        assert False, "invalid expression should raise"
+    except ValueError:
+        pass
+
+
+def test_cache(tmp_path, monkeypatch):
+    from waterz import cache
+
+    affs = random_affinities((5, 10, 10))
+    scoring_function = 'OneMinus<MeanMaxKAffinity<RegionGraphType, 3, ScoreValue>>'
+
+    monkeypatch.setenv('WATERZ_CACHE_DIR', str(tmp_path))
+    monkeypatch.setenv('WATERZ_CACHE_READONLY', '1')
+
+    # nothing is compiled with a read-only cache
+    try:
+        next(wz.agglomerate(affs, [0.5], scoring_function=scoring_function))
+        assert False, "missing module in read-only cache should raise"
+    except RuntimeError:
+        pass
+
+    paths = cache.prewarm([scoring_function])
+    assert len(paths) == 1
+    assert paths[0].startswith(str(tmp_path))
+
+    # the key does not depend on the whitespace of the scoring function
+    assert cache.module_name(scoring_function, 0) == \
+        cache.module_name(''.join(scoring_function.split()), 0)
+
+    segmentation = next(wz.agglomerate(affs, [0.5], scoring_function=scoring_function))
+    assert segmentation.shape == affs.shape[1:]
+
+
+def test_statistics(capfd):
+    affs = random_affinities()
+
+    thresholds = [0.3, 0.6]
+    results = list(wz.agglomerate(affs, thresholds, return_merge_history=True, return_statistics=True))
+
+    for segmentation, merge_history, statistics in results:
+
+        counters = statistics['counters']
+        assert counters['merges'] == len(merge_history)
+        assert counters['pops'] == counters['merges'] + counters['stale'] + counters['deleted']
+        assert counters['peak_queue_size'] > 0
+
+        for stage in ['fragments', 'region_graph', 'merge']:
+            assert statistics['timings'][stage]['wall'] >= 0
+
+    # logging is off by default
+    assert capfd.readouterr().out == ''
+
+
+def test_event_log():
+    affs = random_affinities()
+
+    results = wz.agglomerate(
+        affs,
+        [0.5],
+        return_merge_history=True,
+        return_statistics=True,
+        return_event_log=True)
+
+    for segmentation, merge_history, statistics, events in results:
+
+        counters = statistics['counters']
+        assert counters['dropped_events'] == 0
+
+        # without sampling, there is one event for each pop
+        assert len(events) == counters['pops']
+        h = wz.profiling.histograms(events)
+        assert h['events']['merge'] == counters['merges']
+        assert h['events']['stale'] == counters['stale']
+        assert h['events']['deleted'] == counters['deleted']
+
+        # each merge or deletion ends a chain of stale events
+        chains = wz.profiling.stale_chain_lengths(events)
+        assert chains.sum() == counters['stale']
+        assert len(chains) >= counters['merges'] + counters['deleted']
+
+        assert wz.profiling.merge_degrees(events).sum() == counters['merges']
+
+    # sampling and a small ring buffer
+    results = wz.agglomerate(
+        affs,
+        [0.5],
+        return_statistics=True,
+        return_event_log=True,
+        event_log_size=100,
+        event_log_sampling=4)
+
+    for segmentation, statistics, events in results:
+
+        assert len(events) == 100
+        assert statistics['counters']['dropped_events'] > 0
+        assert np.all(np.diff(events['pop'].astype(np.int64)) > 0)
+
+
+def test_merge_tree():
+    affs = random_affinities()
+
+    fragments, tree = wz.merge_tree(affs)
+    assert tree.dtype.names == ('parent', 'score')
+    assert len(tree) == fragments.max() + 1
+
+    # levels increase towards the root
+    merged = tree['parent'] != np.arange(len(tree))
+    assert np.all(tree['score'][merged] <= tree['score'][tree['parent'][merged]])
+
+    # cutting the tree gives the same segmentations as agglomerating
+    thresholds = [0.1, 0.3, 0.5, 0.7, 0.9]
+    for threshold, segmentation in zip(
+            thresholds,
+            wz.agglomerate(affs, thresholds)):
+
+        assert np.array_equal(wz.cut(tree, fragments, threshold), segmentation)
+
+
+def test_resume(tmp_path):
+    affs = random_affinities()
+    path = str(tmp_path / 'state.bin')
+
+    for kwargs in [
+            {},
+            {'discretize_queue': 256},
+            {'scoring_expression': '(1 - quantile75(aff)) * min(min_size, 1000)'},
+            {'scoring_function': 'OneMinus<MaxAffinity<RegionGraphType, ScoreValue>>'}]:
+
+        thresholds = [0.1, 0.3, 0.5, 0.7]
+        expected = [
+            (s.copy(), h)
+            for s, h in wz.agglomerate(
+                affs,
+                thresholds,
+                return_merge_history=True,
+                **kwargs)
+        ]
+
+        # merging continues exactly where the saved agglomeration stopped
+        for _ in wz.agglomerate(affs, thresholds[:1], checkpoint=path, **kwargs):
+            pass
+        results = [
+            (s.copy(), h)
+            for s, h in wz.resume(
+                path,
+                thresholds[1:],
+                return_merge_history=True)
+        ]
+
+        for (e, eh), (r, rh) in zip(expected[1:], results):
+            assert np.array_equal(e, r)
+            assert np.array_equal(eh, rh)
+
+        # the same agglomeration writes the same state file
+        other_path = str(tmp_path / 'other_state.bin')
+        for _ in wz.agglomerate(affs, thresholds[:1], checkpoint=other_path, **kwargs):
+            pass
+        for _ in wz.agglomerate(affs, thresholds[:1], checkpoint=path, **kwargs):
+            pass
+        with open(path, 'rb') as f, open(other_path, 'rb') as g:
+            assert f.read() == g.read()
+
+    with open(path, 'wb') as f:
+        f.write(b'not a state')
+    try:
+        next(wz.resume(path, [0.5]))
+        assert False, "invalid state file should raise"
+    except RuntimeError:
+        pass
+
+    # truncated in the state of the region merging
+    for _ in wz.agglomerate(affs, [0.1], checkpoint=path):
+        pass
+    with open(path, 'rb') as f:
+        state = f.read()
+    with open(path, 'wb') as f:
+        f.write(state[:-16])
+    try:
+        next(wz.resume(path, [0.5]))
+        assert False, "truncated state file should raise"
+    except RuntimeError:
+        pass
+
+    # contexts are freed when saving fails, or when iterating stops early
+    try:
+        next(wz.agglomerate(
+            affs,
+            [0.1],
+            checkpoint=str(tmp_path / 'missing' / 'state.bin')))
+        assert False, "unwritable checkpoint should raise"
+    except RuntimeError:
+        pass
+    results = wz.agglomerate(affs, [0.1, 0.5])
+    next(results)
+    results.close()
+
+
+def test_agglomerate_region_graph():
+    affs = random_affinities()
+    fragments, _ = wz.merge_tree(affs)
+    num_nodes = int(fragments.max()) + 1
+
+    # region graph statistics as computed by get_region_graph(), where
+    # affs[d] connects each voxel to its predecessor along axis d
+    u, v, a = [], [], []
+    for d in range(3):
+        cur = [slice(None)]*3
+        prev = [slice(None)]*3
+        cur[d] = slice(1, None)
+        prev[d] = slice(None, -1)
+        u.append(fragments[tuple(cur)].ravel())
+        v.append(fragments[tuple(prev)].ravel())
+        a.append(affs[d][tuple(cur)].ravel())
+    u, v, a = np.concatenate(u), np.concatenate(v), np.concatenate(a)
+    u, v = np.minimum(u, v), np.maximum(u, v)
+    mask = (u != v) & (u != 0)
+    keys, edge_ids = np.unique(u[mask]*num_nodes + v[mask], return_inverse=True)
+
+    edges = np.stack([keys // num_nodes, keys % num_nodes], axis=1)
+    max_affinities = np.zeros(len(keys), dtype=np.float32)
+    np.maximum.at(max_affinities, edge_ids, a[mask])
+    node_sizes = np.bincount(fragments.ravel(), minlength=num_nodes)
+
+    thresholds = [0.1, 0.3, 0.5]
+    for scoring in [
+            {'scoring_function': 'OneMinus<MaxAffinity<RegionGraphType, ScoreValue>>'},
+            {'scoring_expression': '(1 - max(aff)) * min(min_size, 20)'}]:
+
+        expected = [
+            s.copy()
+            for s in wz.agglomerate(
+                affs,
+                thresholds,
+                fragments=fragments.copy(),
+                **scoring)
+        ]
+        results = [
+            labels[fragments]
+            for labels in wz.agglomerate_region_graph(
+                edges,
+                num_nodes,
+                thresholds,
+                node_sizes=node_sizes,
+                max_affinities=max_affinities,
+                **scoring)
+        ]
+
+        for e, r in zip(expected, results):
+            assert np.array_equal(e, r)
+
+    # statistics needed by the scoring function have to be given
+    try:
+        next(wz.agglomerate_region_graph(
+            edges,
+            num_nodes,
+            thresholds,
+            scoring_function='OneMinus<MaxAffinity<RegionGraphType, ScoreValue>>'))
+        assert False, "missing statistics should raise"
+    except ValueError:
+        pass
+
+
+def test_stale_edges():
+    # merges make edges stale, either through the statistics of the merged
+    # edges, or through the size of the merged region; compare the merge
+    # order against greedy merging that rescores all edges after each merge
+    graphs = []
+
+    # 2-3 merges first, 3-4 is merged into 2-4, which becomes stale; 1-2
+    # merges next and moves the stale 2-4 to 1-4, where it has to stay stale
+    graphs.append((
+        5,
+        np.array([[2, 3], [1, 2], [2, 4], [3, 4]]),
+        np.array([1, 1, 1, 1], dtype=np.uint64),
+        np.array([0.9, 0.8, 0.7, 0.1], dtype=np.float32),
+        np.array([0, 1, 1, 1, 1], dtype=np.uint64)))
+
+    rng = np.random.RandomState(7)
+    num_nodes = 13
+    pairs = rng.randint(1, num_nodes, size=(40, 2))
+    pairs = np.unique(np.sort(pairs[pairs[:, 0] != pairs[:, 1]], axis=1), axis=0)
+    graphs.append((
+        num_nodes,
+        pairs,
+        rng.randint(1, 10, size=len(pairs)).astype(np.uint64),
+        rng.rand(len(pairs)).astype(np.float32),
+        rng.randint(1, 20, size=num_nodes).astype(np.uint64)))
+
+    scorings = [
+        (
+            {'scoring_function': 'OneMinus<MeanAffinity<RegionGraphType, ScoreValue>>'},
+            lambda mean, sizes: 1 - mean
+        ),
+        (
+            {'scoring_expression': '(1 - mean(aff)) * min_size'},
+            lambda mean, sizes: (1 - mean)*min(sizes)
+        )]
+
+    for num_nodes, pairs, contact_areas, mean_affinities, node_sizes in graphs:
+        for scoring, score in scorings:
+
+            _, history = next(wz.agglomerate_region_graph(
+                pairs.astype(np.uint64),
+                num_nodes,
+                [1000],
+                node_sizes=node_sizes,
+                contact_areas=contact_areas,
+                mean_affinities=mean_affinities,
+                return_merge_history=True,
+                **scoring))
+
+            # regions are sets of nodes, edges map pairs of regions to
+            # (mean, area)
+            sizes = {frozenset([n]): int(node_sizes[n]) for n in range(num_nodes)}
+            edges = {
+                frozenset([frozenset([u]), frozenset([v])]): (float(m), int(c))
+                for (u, v), m, c in zip(pairs, mean_affinities, contact_areas)
+            }
+
+            def edge_score(pair):
+                return score(edges[pair][0], [sizes[r] for r in pair])
+
+            expected = []
+            while edges:
+
+                pair = min(edges, key=edge_score)
+                merged = frozenset.union(*pair)
+                expected.append((merged, edge_score(pair)))
+
+                sizes[merged] = sum(sizes.pop(r) for r in pair)
+                del edges[pair]
+                for other in list(edges):
+                    if not other & pair:
+                        continue
+                    (neighbor,) = other - pair
+                    m, c = edges.pop(other)
+                    key = frozenset([merged, neighbor])
+                    if key in edges:
+                        m2, c2 = edges[key]
+                        m, c = (m*c + m2*c2)/(c + c2), c + c2
+                    edges[key] = (m, c)
+
+            regions = {n: frozenset([n]) for n in range(num_nodes)}
+            assert len(history) == len(expected)
+            for (a, b, c, s), (region, expected_score) in zip(history, expected):
+                regions[c] = regions[a] | regions[b]
+                assert regions[c] == region
+                assert isclose(s, expected_score, rel_tol=1e-5)
+
+
+def test_single_linkage():
+    # max affinity scoring is single-linkage clustering, i.e., merging until t
+    # gives the connected components of the edges with scores below t
+    rng = np.random.RandomState(42)
+    num_nodes = 200
+    pairs = rng.randint(1, num_nodes, size=(1000, 2))
+    pairs = np.unique(np.sort(pairs[pairs[:, 0] != pairs[:, 1]], axis=1), axis=0)
+    max_affinities = rng.rand(len(pairs)).astype(np.float32)
+
+    thresholds = [0.1, 0.3, 0.5]
+    results = [
+        labels.copy()
+        for labels in wz.agglomerate_region_graph(
+            pairs.astype(np.uint64),
+            num_nodes,
+            thresholds,
+            max_affinities=max_affinities,
+            scoring_function='OneMinus<MaxAffinity<RegionGraphType, ScoreValue>>')
+    ]
+
+    for t, labels in zip(thresholds, results):
+
+        parents = list(range(num_nodes))
+
+        def find(x):
+            while parents[x] != x:
+                x = parents[x]
+            return x
+
+        for (u, v), a in zip(pairs, max_affinities):
+            if 1 - a < t:
+                parents[find(u)] = find(v)
+        expected = np.array([find(n) for n in range(num_nodes)])
+
+        # same partition, up to the IDs of the segments
+        joint = np.unique(np.stack([labels, expected]), axis=1)
+        assert len(joint[0]) == len(np.unique(labels)) == len(np.unique(expected))
+
+
+def test_pre_merge():
+    affs = random_affinities()
+    thresholds = [0.3, 0.5, 0.7]
+
+    expected = [s.copy() for s in wz.agglomerate(affs, thresholds)]
+    results = [
+        s.copy()
+        for s in wz.agglomerate(affs, thresholds, pre_merge_threshold=0.1)
+    ]
+
+    # same partitions, up to the IDs of the segments
+    for e, r in zip(expected, results):
+        joint = np.unique(np.stack([e.ravel(), r.ravel()]), axis=1)
+        assert len(joint[0]) == len(np.unique(e)) == len(np.unique(r))
+
+
+def test_merge_batches():
+    affs = random_affinities()
+    thresholds = [0.3, 0.5, 0.7]
+
+    expected = [s.copy() for s in wz.agglomerate(affs, thresholds)]
+
+    for batch_size in [2, 64]:
+
+        results = [
+            s.copy()
+            for s in wz.agglomerate(
+                affs,
+                thresholds,
+                merge_batch_size=batch_size)
+        ]
+
+        # same partitions, up to the IDs of the segments
+        for e, r in zip(expected, results):
+            joint = np.unique(np.stack([e.ravel(), r.ravel()]), axis=1)
+            assert len(joint[0]) == len(np.unique(e)) == len(np.unique(r))
+
+    # merge events name the merged edge, also when reported after later pops
+    _, _, events = next(wz.agglomerate(
+        affs,
+        [0.5],
+        return_merge_history=True,
+        return_event_log=True))
+    expected_edges = np.sort(events['edge'][events['type'] == wz.profiling.MERGE])
+    _, history, events = next(wz.agglomerate(
+        affs,
+        [0.5],
+        return_merge_history=True,
+        return_event_log=True,
+        merge_batch_size=64))
+    merges = events[events['type'] == wz.profiling.MERGE]
+    assert np.array_equal(np.sort(merges['edge']), expected_edges)
+    assert np.array_equal(merges['new_score'], history['score'])
+    assert np.array_equal(merges['a'], history['c'])
+
+    # edges that were not selected are logged when put back, such that there
+    # is still one event for each pop
+    _, statistics, events = next(wz.agglomerate(
+        affs,
+        [0.5],
+        return_statistics=True,
+        return_event_log=True,
+        merge_batch_size=64))
+    counters = statistics['counters']
+    h = wz.profiling.histograms(events)
+    assert len(events) == counters['pops']
+    assert h['events']['put_back'] > 0
+    assert wz.profiling.stale_chain_lengths(events).sum() == counters['stale']
+
+
+def test_merge_batches_threads():
+    # the number of threads is read once per process, set it for a new one
+    script = '''
+import numpy as np
+import waterz as wz
+
+np.random.seed(0)
+affs = np.random.rand(3, 20, 40, 40).astype(np.float32)
+thresholds = [0.3, 0.5, 0.7]
+
+# large batches select enough independent edges to merge on several threads
+expected = [s.copy() for s in wz.agglomerate(affs, thresholds)]
+results = [s.copy() for s in wz.agglomerate(affs, thresholds, merge_batch_size=4096)]
+
+for e, r in zip(expected, results):
+    joint = np.unique(np.stack([e.ravel(), r.ravel()]), axis=1)
+    assert len(joint[0]) == len(np.unique(e)) == len(np.unique(r))
+'''
+    env = dict(os.environ, WATERZ_NUM_THREADS='4')
+    subprocess.run([sys.executable, '-c', script], env=env, check=True)
+
+
+def test_merge_small_fragments():
+    affs = random_affinities()
+
+    fragments = next(wz.agglomerate(affs, [0])).copy()
+    merged = next(wz.agglomerate(affs, [0], fragment_size_threshold=10)).copy()
+
+    # fragments are only merged, and IDs are consecutive
+    ids, sizes = np.unique(merged[merged != 0], return_counts=True)
+    assert np.array_equal(ids, np.arange(1, len(ids) + 1))
+    assert len(ids) < len(np.unique(fragments))
+    joint = np.unique(np.stack([fragments.ravel(), merged.ravel()]), axis=1)
+    assert len(joint[0]) == len(np.unique(fragments))
+
+    # without an affinity threshold, all fragments grow to the size threshold
+    assert np.all(sizes >= 10)
+
+
+def test_fragments_in_xy(monkeypatch):
+    monkeypatch.setenv('WATERZ_NUM_THREADS', '4')
+    affs = random_affinities()
+
+    fragments = next(wz.agglomerate(affs, [0], fragments_in_xy=True)).copy()
+
+    # same as the watershed of each section on its own, with unique IDs
+    offset = 0
+    for z in range(affs.shape[1]):
+        section = next(wz.agglomerate(affs[:, z:z+1], [0])).copy()
+        assert np.array_equal(fragments[z:z+1], np.where(section, section + offset, 0))
+        offset += section.max()
+
+    # fragments are agglomerated in 3D
+    segmentation = next(wz.agglomerate(affs, [0.5], fragments_in_xy=True))
+    assert np.any(segmentation[0] == segmentation[1])
+
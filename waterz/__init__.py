@@ -1,8 +1,15 @@
 from __future__ import absolute_import
 from .evaluate import evaluate
+from .cut import cut
+from . import prebuilt
+from . import cache
+from . import profiling
 
 __version__ = '0.8'
 
+# scoring function that evaluates scoring expressions at runtime
+EXPRESSION_SCORING_FUNCTION = 'ExpressionScore<RegionGraphType, ScoreValue>'
+
 def agglomerate(
         affs,
         thresholds,
@@ -14,7 +21,18 @@ def agglomerate(
         return_region_graph = False,
         scoring_function = 'OneMinus<MeanAffinity<RegionGraphType, ScoreValue>>',
         discretize_queue = 0,
-        force_rebuild = False):
+        force_rebuild = False,
+        scoring_expression = None,
+        return_statistics = False,
+        return_event_log = False,
+        event_log_size = 1<<20,
+        event_log_sampling = 1,
+        checkpoint = None,
+        pre_merge_threshold = None,
+        merge_batch_size = 0,
+        fragment_size_threshold = 0,
+        fragment_aff_threshold = 0.0,
+        fragments_in_xy = False):
     '''
     Compute segmentations from an affinity graph for several thresholds.
 
@@ -80,6 +98,104 @@ def agglomerate(
 
             Force the rebuild of the module. Only needed for development.
 
+            Common scoring functions and queues are compiled when waterz gets
+            installed (see ``waterz/prebuilt.py``), other ones are compiled on
+            the first call and stored in a build cache, which can be shared
+            and pre-warmed (see ``waterz/cache.py``).
+
+        scoring_expression: string (optional)
+
+            A scoring function given as an expression that is evaluated at
+            runtime, e.g., '1 - quantile75(aff) * log(contact_area)'. Does not
+            require a compilation for new expressions. If given,
+            scoring_function is ignored. See
+
+                https://github.com/funkey/waterz/blob/master/waterz/backend/ScoringExpression.hpp
+
+            for the available statistics and functions.
+
+        return_statistics: bool
+
+            If set to True, the returning tuple will contain timings and
+            counters of the agglomeration.
+
+        return_event_log: bool
+
+            If set to True, the returning tuple will contain the events of the
+            merge loop. See waterz.profiling for how to analyze them.
+
+        event_log_size: int, default 2^20
+
+            The number of events to keep per threshold. Older events are
+            dropped (and counted in the statistics as 'dropped_events').
+
+        event_log_sampling: int, default 1
+
+            Record only the events of every n-th edge (selected by a hash of
+            the edge ID), to reduce the overhead. All events of a sampled edge
+            are recorded.
+
+        checkpoint: string (optional)
+
+            A file to save the state of agglomeration to after each threshold.
+            Merging can be continued from this file with resume(), without
+            computing the fragments and the region graph again. The file is
+            replaced atomically.
+
+        pre_merge_threshold: float (optional)
+
+            If given, all edges whose initial score is below this threshold are
+            merged at once before the regular agglomeration, which is much
+            faster than merging them one by one. The segmentations are the
+            same (up to the segment IDs), unless merges increase the score of
+            one of these edges to the threshold or above (e.g., for scores
+            that grow with the region size). Pre-merges are not part of the
+            merge history.
+
+        merge_batch_size: int, default 0
+
+            If set to non-zero, up to this many edges are taken from the queue
+            at once, and those that are the cheapest edge of their regions and
+            do not share regions or neighbors with each other are merged in
+            parallel. The merges of a batch are reported in the merge history
+            in queue order. The number of threads can be set with
+            WATERZ_NUM_THREADS. Batches are merged serially for the
+            Random scoring function, whose statistics are not thread-safe.
+
+            The segmentations are the same as for merging one edge at a time,
+            up to the order of edges with equal scores (with discretize_queue,
+            up to the resolution of the bins), if merging never makes an edge
+            cheaper than the cheapest of the edges it was merged from. This
+            holds for scores that lie between the scores of the merged edges
+            (mean, quantiles, min, and max of affinities), also when
+            multiplied with sizes of regions (like min_size). It does not hold
+            for scores that decrease as edges grow, like
+            '1 - quantile75(aff) * log(contact_area)', for which batches can
+            merge in a different order.
+
+        fragment_size_threshold: int, default 0
+
+            If set to non-zero, fragments found by the watershed with fewer
+            voxels than this are merged into their neighbors before the region
+            graph is extracted, strongest affinity first. This can reduce the
+            number of fragments by an order of magnitude. Ignored if fragments
+            are given.
+
+        fragment_aff_threshold: float, default 0.0
+
+            Small fragments are only merged along affinities of at least this
+            value.
+
+        fragments_in_xy: bool, default False
+
+            If set to True, the watershed is computed independently (and in
+            parallel) for each z-section, ignoring the affinities along z
+            (affs[0]). Fragments do not span sections, and are agglomerated in
+            3D as usual. Ignored if fragments are given.
+
+    Progress messages are logged to the 'waterz' logger. Messages of the C++
+    part are printed to stdout if the logger is enabled for DEBUG.
+
     Returns
     -------
 
@@ -102,14 +218,36 @@ def agglomerate(
 
         merge_history (only if return_merge_history is True)
 
-            A list of dictionaries with keys 'a', 'b', 'c', and 'score',
+            A numpy structured array with fields 'a', 'b', 'c', and 'score',
             indicating that region a got merged with b into c with the given
-            score.
+            score. The array wraps the memory of the C++ merge history without
+            a copy.
 
         region_graph (only if return_region_graph is True)
 
-            A list of dictionaries with keys 'u', 'v', and 'score', indicating
-            an edge between u and v with the given score.
+            A numpy structured array with fields 'u', 'v', and 'score',
+            indicating an edge between u and v with the given score. The array
+            wraps the memory of the C++ region graph without a copy.
+
+        statistics (only if return_statistics is True)
+
+            A dictionary with the keys 'timings' and 'counters'. 'timings'
+            maps the stages 'fragments', 'region_graph', 'ground_truth',
+            'merge', and 'extract_segmentation' to dictionaries with the 'wall'
+            and 'cpu' time in seconds. If no fragments are given, the region
+            graph is extracted during the watershed and its time is part of
+            'fragments'. 'counters' contains 'pops', 'stale',
+            'deleted', 'merges', 'peak_queue_size', and 'allocated_bytes'. The
+            merge and extract_segmentation timings and the counters are for
+            the current threshold only.
+
+        event_log (only if return_event_log is True)
+
+            A numpy structured array with one entry for each (sampled) edge
+            taken from the queue while merging to the current threshold, with
+            fields 'timestamp' (ns), 'pop' (number of pops so far, including
+            this one), 'edge', 'a', 'b' (for merges, b got merged into a),
+            'old_score', 'new_score', and 'type' (see waterz.profiling).
 
     Examples
     --------
@@ -130,133 +268,383 @@ def agglomerate(
             # ...
     '''
 
-    import sys, os
-    import shutil
-    import glob
-    import numpy
-    import fcntl
-
-    try:
-        import hashlib
-    except ImportError:
-        import md5 as hashlib
-
-    from distutils.core import Distribution, Extension
-    from distutils.command.build_ext import build_ext
-    from distutils.sysconfig import get_config_vars, get_python_inc
-
-    import Cython
-    from Cython.Compiler.Main import Context, default_options
-    from Cython.Build.Dependencies import cythonize
-
-    # compile agglomerate.pyx for given scoring function
-
-    source_dir = os.path.dirname(os.path.abspath(__file__))
-    source_files = [
-            os.path.join(source_dir, 'agglomerate.pyx'),
-            os.path.join(source_dir, 'frontend_agglomerate.h'),
-            os.path.join(source_dir, 'frontend_agglomerate.cpp')
-    ]
-    source_files += glob.glob(source_dir + '/backend/*.hpp')
-    source_files.sort()
-    source_files_hashes = [ hashlib.md5(open(f, 'r').read().encode('utf-8')).hexdigest() for f in source_files ]
-
-    key = scoring_function, discretize_queue, source_files_hashes, sys.version_info, sys.executable, Cython.__version__
-    module_name = 'waterz_' + hashlib.md5(str(key).encode('utf-8')).hexdigest()
-    lib_dir=os.path.expanduser('~/.cython/inline')
-
-    # since this could be called concurrently, there is no good way to check
-    # whether the directory already exists
-    try:
-        os.makedirs(lib_dir)
-    except:
-        pass
-
-    # make sure the same module is not build concurrently
-    with open(os.path.join(lib_dir, module_name + '.lock'), 'w') as lock_file:
-        fcntl.lockf(lock_file, fcntl.LOCK_EX)
-
-        try:
-
-            if lib_dir not in sys.path:
-                sys.path.append(lib_dir)
-            if force_rebuild:
-                raise ImportError
-            else:
-                __import__(module_name)
-
-            print("Re-using already compiled waterz version")
-
-        except ImportError:
-
-            print("Compiling waterz in " + str(lib_dir))
-
-            cython_include_dirs = ['.']
-            ctx = Context(cython_include_dirs, default_options)
-
-            include_dir = os.path.join(lib_dir, module_name)
-            if not os.path.exists(include_dir):
-                os.makedirs(include_dir)
-
-            include_dirs = [
-                source_dir,
-                include_dir,
-                os.path.join(source_dir, 'backend'),
-                os.path.dirname(get_python_inc()),
-                numpy.get_include(),
-            ]
-
-            scoring_function_header = os.path.join(include_dir, 'ScoringFunction.h')
-            with open(scoring_function_header, 'w') as f:
-                f.write('typedef %s ScoringFunctionType;'%scoring_function)
-
-            queue_header = os.path.join(include_dir, 'Queue.h')
-            with open(queue_header, 'w') as f:
-                if discretize_queue == 0:
-                    f.write('template<typename T, typename S> using QueueType = PriorityQueue<T, S>;')
-                else:
-                    f.write('template<typename T, typename S> using QueueType = BinQueue<T, S, %d>;'%discretize_queue)
-
-            # cython requires that the pyx file has the same name as the module
-            shutil.copy(
-                    os.path.join(source_dir, 'agglomerate.pyx'),
-                    os.path.join(lib_dir, module_name + '.pyx')
-            )
-            shutil.copy(
-                    os.path.join(source_dir, 'frontend_agglomerate.cpp'),
-                    os.path.join(lib_dir, module_name + '_frontend_agglomerate.cpp')
-            )
-
-            # Remove the "-Wstrict-prototypes" compiler option, which isn't valid 
-            # for C++.
-            cfg_vars = get_config_vars()
-            if "CFLAGS" in cfg_vars:
-                cfg_vars["CFLAGS"] = cfg_vars["CFLAGS"].replace("-Wstrict-prototypes", "")
-
-            extension = Extension(
-                    module_name,
-                    sources = [
-                        os.path.join(lib_dir, module_name + '.pyx'),
-                        os.path.join(lib_dir, module_name + '_frontend_agglomerate.cpp')
-                    ],
-                    include_dirs=include_dirs,
-                    language='c++',
-                    extra_link_args=['-std=c++11'],
-                    extra_compile_args=['-std=c++11', '-w']
-            )
-            build_extension = build_ext(Distribution())
-            build_extension.finalize_options()
-            build_extension.extensions = cythonize([extension], quiet=True, nthreads=2)
-            build_extension.build_temp = lib_dir
-            build_extension.build_lib  = lib_dir
-            build_extension.run()
-
-    return __import__(module_name).agglomerate(
-        affs,
+    if scoring_expression is not None:
+        scoring_function = EXPRESSION_SCORING_FUNCTION
+    else:
+        scoring_expression = ''
+
+    return _get_agglomerate_module(
+        scoring_function,
+        discretize_queue,
+        force_rebuild).agglomerate(
+            affs,
+            thresholds,
+            gt,
+            fragments,
+            aff_threshold_low,
+            aff_threshold_high,
+            return_merge_history,
+            return_region_graph,
+            scoring_expression,
+            return_statistics,
+            return_event_log,
+            event_log_size,
+            event_log_sampling,
+            checkpoint,
+            _state_info(scoring_function, discretize_queue),
+            pre_merge_threshold,
+            merge_batch_size,
+            fragment_size_threshold,
+            fragment_aff_threshold,
+            fragments_in_xy)
+
+def agglomerate_region_graph(
+        edges,
+        num_nodes,
+        thresholds,
+        node_sizes = None,
+        contact_areas = None,
+        mean_affinities = None,
+        max_affinities = None,
+        min_affinities = None,
+        histograms = None,
+        max_k_affinities = None,
+        return_merge_history = False,
+        return_region_graph = False,
+        scoring_function = 'OneMinus<MeanAffinity<RegionGraphType, ScoreValue>>',
+        discretize_queue = 0,
+        force_rebuild = False,
+        scoring_expression = None,
+        return_statistics = False,
+        return_event_log = False,
+        event_log_size = 1<<20,
+        event_log_sampling = 1,
+        checkpoint = None):
+    '''
+    Agglomerate a precomputed region graph, e.g., one that was extracted
+    blockwise, without reading voxel data.
+
+    Only the statistics needed by the scoring function have to be given. The
+    statistics of each edge have to be the ones of all affinities between the
+    two nodes, see backend/region_graph.hpp for how they are extracted from
+    voxel data.
+
+    Parameters
+    ----------
+
+        edges: numpy array, uint64, shape (n, 2)
+
+            The edges (u, v) of the region graph. Each pair of nodes must be
+            connected by at most one edge. Edges with the same score are
+            merged in the order they are given.
+
+        num_nodes: int
+
+            The number of nodes, node IDs are 0 to num_nodes - 1.
+
+        thresholds:
+
+            See agglomerate().
+
+        node_sizes: numpy array, uint64, shape (num_nodes,)
+
+            The number of voxels of each node (for MinSize, MaxSize, min_size,
+            max_size).
+
+        contact_areas: numpy array, uint64, shape (n,)
+
+            The number of affinities of each edge (for ContactArea,
+            MeanAffinity, contact_area, mean(aff)).
+
+        mean_affinities, max_affinities, min_affinities: numpy arrays, float32, shape (n,)
+
+            The mean, max, and min affinity of each edge.
+
+        histograms: numpy array, uint32, shape (n, 256)
+
+            A histogram of the affinities in [0, 1] of each edge (for
+            HistogramQuantileAffinity, quantile<q>(aff)).
+
+        max_k_affinities: numpy array, float32, shape (n, k)
+
+            The k largest affinities of each edge, padded with the lowest
+            float32 value (for MeanMaxKAffinity).
+
+        return_merge_history, return_region_graph, scoring_function,
+        discretize_queue, force_rebuild, scoring_expression,
+        return_statistics, return_event_log, event_log_size,
+        event_log_sampling, checkpoint:
+
+            See agglomerate().
+
+    Returns
+    -------
+
+        Same as agglomerate(), without metrics. Instead of a segmentation, a
+        numpy array of shape (num_nodes,) with the segment of each node is
+        returned, i.e., the segmentation of a fragments volume is
+        ``labels[fragments]``. Agglomerations resumed from a checkpoint
+        return the same array with shape (1, 1, num_nodes).
+    '''
+
+    if scoring_expression is not None:
+        scoring_function = EXPRESSION_SCORING_FUNCTION
+    else:
+        scoring_expression = ''
+
+    return _get_agglomerate_module(
+        scoring_function,
+        discretize_queue,
+        force_rebuild).agglomerate_region_graph(
+            edges,
+            num_nodes,
+            thresholds,
+            node_sizes,
+            contact_areas,
+            mean_affinities,
+            max_affinities,
+            min_affinities,
+            histograms,
+            max_k_affinities,
+            return_merge_history,
+            return_region_graph,
+            scoring_expression,
+            return_statistics,
+            return_event_log,
+            event_log_size,
+            event_log_sampling,
+            checkpoint,
+            _state_info(scoring_function, discretize_queue))
+
+def resume(
+        path,
         thresholds,
+        return_merge_history = False,
+        return_region_graph = False,
+        return_statistics = False,
+        return_event_log = False,
+        event_log_size = 1<<20,
+        event_log_sampling = 1,
+        checkpoint = None,
+        force_rebuild = False):
+    '''
+    Continue agglomeration from a state saved with agglomerate(...,
+    checkpoint=path).
+
+    The scoring function, queue, and scoring expression are the ones of the
+    saved agglomeration. Thresholds lower than the last threshold of the saved
+    agglomeration return the segmentation of that threshold. Ground-truth
+    metrics are not available for resumed agglomerations.
+
+    Parameters
+    ----------
+
+        path: string
+
+            The file written by agglomerate() or resume().
+
+        thresholds, return_merge_history, return_region_graph,
+        return_statistics, return_event_log, event_log_size,
+        event_log_sampling, checkpoint, force_rebuild:
+
+            See agglomerate(). checkpoint can be the same as path.
+
+    Returns
+    -------
+
+        Same as agglomerate(), without metrics.
+
+    Examples
+    --------
+
+        # compute fragments, region graph, and initial scores only once
+        for _ in agglomerate(affs, [0], checkpoint='state.bin'):
+            pass
+
+        for segmentation in resume('state.bin', [0.1, 0.5, 0.9]):
+            # ...
+    '''
+
+    scoring_function, discretize_queue = _read_state_info(path)
+
+    return _get_agglomerate_module(
+        scoring_function,
+        discretize_queue,
+        force_rebuild).resume(
+            path,
+            thresholds,
+            return_merge_history,
+            return_region_graph,
+            return_statistics,
+            return_event_log,
+            event_log_size,
+            event_log_sampling,
+            checkpoint,
+            _state_info(scoring_function, discretize_queue))
+
+def _state_info(scoring_function, discretize_queue):
+    '''Information stored with saved states to find the module to resume.'''
+
+    import json
+
+    return json.dumps({
+        'scoring_function': scoring_function,
+        'discretize_queue': discretize_queue
+    })
+
+def _read_state_info(path):
+    '''
+    Read the scoring function and queue from a state file, see saveState() in
+    frontend_agglomerate.h for the layout.
+    '''
+
+    import json
+    import struct
+
+    with open(path, 'rb') as f:
+
+        header = f.read(24)
+        if len(header) != 24 or header[:8] != b'WATERZST':
+            raise RuntimeError("%s is not a waterz state file" % path)
+
+        magic, version, size = struct.unpack('<8sQQ', header)
+
+        info = json.loads(f.read(size).decode('utf-8'))
+
+    return info['scoring_function'], info['discretize_queue']
+
+def evaluate_merge_curve(
+        affs,
         gt,
-        fragments,
-        aff_threshold_low,
-        aff_threshold_high,
-        return_merge_history,
-        return_region_graph)
+        fragments = None,
+        aff_threshold_low  = 0.0001,
+        aff_threshold_high = 0.9999,
+        scoring_function = 'OneMinus<MeanAffinity<RegionGraphType, ScoreValue>>',
+        discretize_queue = 0,
+        force_rebuild = False,
+        scoring_expression = None):
+    '''
+    Agglomerate until all regions are merged and compute the metrics against
+    the ground-truth after every single merge.
+
+    The metrics are updated incrementally with each merge, i.e., this is much
+    faster than calling agglomerate() with many thresholds.
+
+    Parameters
+    ----------
+
+        affs, fragments, aff_threshold_low, aff_threshold_high,
+        scoring_function, discretize_queue, force_rebuild, scoring_expression:
+
+            See agglomerate().
+
+        gt: numpy array, uint32, 3 dimensional
+
+            The ground-truth segmentation as an array with gt[z][y][x].
+
+    Returns
+    -------
+
+        A dictionary of numpy arrays with one entry per merge, in the order of
+        the merges. The keys are 'score' (the score of the merge), and
+        'V_Rand_split', 'V_Rand_merge', 'V_Info_split', and 'V_Info_merge'
+        (the metrics of the segmentation right after the merge).
+    '''
+
+    if scoring_expression is not None:
+        scoring_function = EXPRESSION_SCORING_FUNCTION
+    else:
+        scoring_expression = ''
+
+    return _get_agglomerate_module(
+        scoring_function,
+        discretize_queue,
+        force_rebuild).evaluate_merge_curve(
+            affs,
+            gt,
+            fragments,
+            aff_threshold_low,
+            aff_threshold_high,
+            scoring_expression)
+
+def merge_tree(
+        affs,
+        fragments = None,
+        aff_threshold_low  = 0.0001,
+        aff_threshold_high = 0.9999,
+        scoring_function = 'OneMinus<MeanAffinity<RegionGraphType, ScoreValue>>',
+        discretize_queue = 0,
+        force_rebuild = False,
+        scoring_expression = None):
+    '''
+    Agglomerate until all regions are merged and get the merge tree
+    (dendrogram). Segmentations for any threshold can then be obtained with
+    cut(), without agglomerating again.
+
+    Parameters
+    ----------
+
+        affs, fragments, aff_threshold_low, aff_threshold_high,
+        scoring_function, discretize_queue, force_rebuild, scoring_expression:
+
+            See agglomerate().
+
+    Returns
+    -------
+
+        A tuple (fragments, tree). fragments are the initial regions (the
+        given ones, or the result of the watershed). tree is a numpy
+        structured array with one entry per fragment ID and fields 'parent'
+        (the region the fragment got merged into, or the fragment itself, if
+        it was never merged) and 'score' (the level of this merge, infinite
+        for fragments that were never merged). Levels increase towards the
+        root, and cutting the tree at threshold t gives the same segmentation
+        as agglomerate() for t.
+
+    Examples
+    --------
+
+        fragments, tree = merge_tree(affs)
+
+        for threshold in [0.1, 0.2, 0.3]:
+            segmentation = cut(tree, fragments, threshold)
+    '''
+
+    if scoring_expression is not None:
+        scoring_function = EXPRESSION_SCORING_FUNCTION
+    else:
+        scoring_expression = ''
+
+    return _get_agglomerate_module(
+        scoring_function,
+        discretize_queue,
+        force_rebuild).merge_tree(
+            affs,
+            fragments,
+            aff_threshold_low,
+            aff_threshold_high,
+            scoring_expression)
+
+def _get_agglomerate_module(
+        scoring_function,
+        discretize_queue,
+        force_rebuild):
+    '''
+    Get the agglomerate module for the given scoring function and queue. Uses
+    a module that was compiled at install time if there is one, otherwise
+    gets it from the build cache (see waterz/cache.py).
+    '''
+
+    import importlib
+
+    if not force_rebuild:
+
+        name = prebuilt.module_name(scoring_function, discretize_queue)
+
+        if name is not None:
+            try:
+                return importlib.import_module('.' + name, __name__)
+            except ImportError:
+                pass
+
+    return cache.load(scoring_function, discretize_queue, force_rebuild)
@@ -1,9 +1,14 @@
 from libcpp.vector cimport vector
-from libc.stdint cimport uint64_t, uint32_t
+from libc.stdint cimport uint64_t, uint32_t, uint8_t
 from libcpp cimport bool
+from libcpp.string cimport string
+import logging
+import os
 import numpy as np
 cimport numpy as np
 
+logger = logging.getLogger(__name__)
+
 def agglomerate(
         affs,
         thresholds,
@@ -12,63 +17,415 @@ def agglomerate(
         aff_threshold_low=0.0001,
         aff_threshold_high=0.9999,
         return_merge_history=False,
-        return_region_graph=False):
+        return_region_graph=False,
+        scoring_expression='',
+        return_statistics=False,
+        return_event_log=False,
+        event_log_size=1<<20,
+        event_log_sampling=1,
+        checkpoint=None,
+        checkpoint_info='',
+        pre_merge_threshold=None,
+        merge_batch_size=0,
+        fragment_size_threshold=0,
+        fragment_aff_threshold=0.0,
+        fragments_in_xy=False):
 
     # the C++ part assumes contiguous memory, make sure we have it (and do 
     # nothing, if we do)
     if not affs.flags['C_CONTIGUOUS']:
-        print("Creating memory-contiguous affinity arrray (avoid this by passing C_CONTIGUOUS arrays)")
+        logger.info("Creating memory-contiguous affinity arrray (avoid this by passing C_CONTIGUOUS arrays)")
         affs = np.ascontiguousarray(affs)
     if gt is not None and not gt.flags['C_CONTIGUOUS']:
-        print("Creating memory-contiguous ground-truth arrray (avoid this by passing C_CONTIGUOUS arrays)")
+        logger.info("Creating memory-contiguous ground-truth arrray (avoid this by passing C_CONTIGUOUS arrays)")
         gt = np.ascontiguousarray(gt)
     if fragments is not None and not fragments.flags['C_CONTIGUOUS']:
-        print("Creating memory-contiguous fragments arrray (avoid this by passing C_CONTIGUOUS arrays)")
+        logger.info("Creating memory-contiguous fragments arrray (avoid this by passing C_CONTIGUOUS arrays)")
         fragments = np.ascontiguousarray(fragments)
 
-    print("Preparing segmentation volume...")
+    logger.debug("Preparing segmentation volume...")
+
+    if fragments is None:
+        volume_shape = (affs.shape[1], affs.shape[2], affs.shape[3])
+        segmentation = np.zeros(volume_shape, dtype=np.uint64)
+        find_fragments = True
+    else:
+        segmentation = fragments
+        find_fragments = False
+
+    cdef WaterzState state = __initialize(affs, segmentation, gt, aff_threshold_low, aff_threshold_high, find_fragments, scoring_expression, pre_merge_threshold, fragment_size_threshold, fragment_aff_threshold, fragments_in_xy)
+
+    if merge_batch_size > 0:
+        setMergeBatchSize(state, merge_batch_size)
+
+    yield from __merge_thresholds(
+        state,
+        segmentation,
+        thresholds,
+        gt is not None,
+        return_merge_history,
+        return_region_graph,
+        return_statistics,
+        return_event_log,
+        event_log_size,
+        event_log_sampling,
+        checkpoint,
+        checkpoint_info)
+
+def agglomerate_region_graph(
+        edges,
+        num_nodes,
+        thresholds,
+        node_sizes=None,
+        contact_areas=None,
+        mean_affinities=None,
+        max_affinities=None,
+        min_affinities=None,
+        histograms=None,
+        max_k_affinities=None,
+        return_merge_history=False,
+        return_region_graph=False,
+        scoring_expression='',
+        return_statistics=False,
+        return_event_log=False,
+        event_log_size=1<<20,
+        event_log_sampling=1,
+        checkpoint=None,
+        checkpoint_info=''):
+
+    edges = np.ascontiguousarray(edges, dtype=np.uint64)
+    if edges.ndim != 2 or edges.shape[1] != 2:
+        raise ValueError("edges have to be given as an array of shape (n, 2)")
+
+    cdef size_t c_num_nodes = num_nodes
+    cdef size_t c_num_edges = edges.shape[0]
+    cdef StatisticsSeedsType seeds
+
+    def per_node(array, dtype):
+        if array is None:
+            return None
+        array = np.ascontiguousarray(array, dtype=dtype)
+        if array.shape != (num_nodes,):
+            raise ValueError("expected an array of shape (%d,)" % num_nodes)
+        return array
+
+    def per_edge(array, dtype, ndim=1):
+        if array is None:
+            return None
+        array = np.ascontiguousarray(array, dtype=dtype)
+        if array.ndim != ndim or array.shape[0] != c_num_edges:
+            raise ValueError(
+                "expected an array with %d dimension(s) and %d rows" % (
+                    ndim, c_num_edges))
+        return array
+
+    # keep the arrays referenced while seeding
+    node_sizes = per_node(node_sizes, np.uint64)
+    contact_areas = per_edge(contact_areas, np.uint64)
+    mean_affinities = per_edge(mean_affinities, np.float32)
+    max_affinities = per_edge(max_affinities, np.float32)
+    min_affinities = per_edge(min_affinities, np.float32)
+    histograms = per_edge(histograms, np.uint32, ndim=2)
+    max_k_affinities = per_edge(max_k_affinities, np.float32, ndim=2)
+
+    seeds.regionSizes = <const uint64_t*>__data(node_sizes)
+    seeds.contactAreas = <const uint64_t*>__data(contact_areas)
+    seeds.meanAffinities = <const float*>__data(mean_affinities)
+    seeds.maxAffinities = <const float*>__data(max_affinities)
+    seeds.minAffinities = <const float*>__data(min_affinities)
+    seeds.histograms = <const uint32_t*>__data(histograms)
+    if histograms is not None:
+        seeds.histogramBins = histograms.shape[1]
+    seeds.maxKAffinities = <const float*>__data(max_k_affinities)
+    if max_k_affinities is not None:
+        seeds.maxK = max_k_affinities.shape[1]
+
+    labels = np.zeros((num_nodes,), dtype=np.uint64)
+
+    cdef const uint64_t* edges_data = <const uint64_t*>__data(edges)
+    cdef uint64_t* labels_data = <uint64_t*>__data(labels)
+    cdef string c_scoring_expression = scoring_expression.encode()
+    cdef WaterzState state
+
+    setLogging(logger.isEnabledFor(logging.DEBUG))
+
+    with nogil:
+        state = initializeFromRegionGraph(
+            c_num_nodes,
+            c_num_edges,
+            edges_data,
+            seeds,
+            labels_data,
+            c_scoring_expression)
+
+    yield from __merge_thresholds(
+        state,
+        labels,
+        thresholds,
+        False,
+        return_merge_history,
+        return_region_graph,
+        return_statistics,
+        return_event_log,
+        event_log_size,
+        event_log_sampling,
+        checkpoint,
+        checkpoint_info)
+
+def resume(
+        path,
+        thresholds,
+        return_merge_history=False,
+        return_region_graph=False,
+        return_statistics=False,
+        return_event_log=False,
+        event_log_size=1<<20,
+        event_log_sampling=1,
+        checkpoint=None,
+        checkpoint_info=''):
+
+    cdef string c_path = os.fsencode(path)
+    cdef vector[size_t] shape
+
+    setLogging(logger.isEnabledFor(logging.DEBUG))
+
+    shape = getSavedShape(c_path)
+    segmentation = np.zeros((shape[0], shape[1], shape[2]), dtype=np.uint64)
+
+    cdef WaterzState state = __resume(c_path, segmentation)
+
+    yield from __merge_thresholds(
+        state,
+        segmentation,
+        thresholds,
+        False,
+        return_merge_history,
+        return_region_graph,
+        return_statistics,
+        return_event_log,
+        event_log_size,
+        event_log_sampling,
+        checkpoint,
+        checkpoint_info)
+
+def __merge_thresholds(
+        WaterzState state,
+        segmentation,
+        thresholds,
+        has_gt,
+        return_merge_history,
+        return_region_graph,
+        return_statistics,
+        return_event_log,
+        event_log_size,
+        event_log_sampling,
+        checkpoint,
+        checkpoint_info):
+
+    cdef vector[Merge] merges
+    cdef vector[ScoredEdge] edges
+    cdef vector[Event] events
+    cdef float c_threshold
+    cdef string c_checkpoint
+    cdef string c_checkpoint_info
+
+    # the context is freed also if merging raises, or the caller stops
+    # iterating early (which raises GeneratorExit at the yield)
+    try:
+
+        c_checkpoint_info = checkpoint_info.encode()
+        if checkpoint is not None:
+            c_checkpoint = os.fsencode(checkpoint)
+
+        if return_event_log:
+            setEventLog(state, event_log_size, event_log_sampling)
+
+        thresholds.sort()
+        for threshold in thresholds:
+
+            c_threshold = threshold
+            with nogil:
+                merges = mergeUntil(state, c_threshold)
+            merge_history = __merge_history_to_array(merges)
+
+            if checkpoint is not None:
+                with nogil:
+                    saveState(state, c_checkpoint, c_checkpoint_info)
+
+            result = (segmentation,)
+
+            if has_gt:
+
+                stats = {}
+                stats['V_Rand_split'] = state.metrics.rand_split
+                stats['V_Rand_merge'] = state.metrics.rand_merge
+                stats['V_Info_split'] = state.metrics.voi_split
+                stats['V_Info_merge'] = state.metrics.voi_merge
+
+                result += (stats,)
+
+            if return_merge_history:
+
+                result += (merge_history,)
+
+            if return_region_graph:
+
+                with nogil:
+                    edges = getRegionGraph(state)
+                result += (__region_graph_to_array(edges),)
+
+            if return_statistics:
+
+                result += (__statistics(state),)
+
+            if return_event_log:
+
+                events = getEventLog(state)
+                result += (__event_log_to_array(events),)
+
+            if len(result) == 1:
+                yield result[0]
+            else:
+                yield result
+
+    finally:
+        with nogil:
+            free(state)
+
+def evaluate_merge_curve(
+        affs,
+        gt,
+        fragments=None,
+        aff_threshold_low=0.0001,
+        aff_threshold_high=0.9999,
+        scoring_expression=''):
+
+    if not affs.flags['C_CONTIGUOUS']:
+        logger.info("Creating memory-contiguous affinity arrray (avoid this by passing C_CONTIGUOUS arrays)")
+        affs = np.ascontiguousarray(affs)
+    if not gt.flags['C_CONTIGUOUS']:
+        logger.info("Creating memory-contiguous ground-truth arrray (avoid this by passing C_CONTIGUOUS arrays)")
+        gt = np.ascontiguousarray(gt)
+    if fragments is not None and not fragments.flags['C_CONTIGUOUS']:
+        logger.info("Creating memory-contiguous fragments arrray (avoid this by passing C_CONTIGUOUS arrays)")
+        fragments = np.ascontiguousarray(fragments)
 
     if fragments is None:
         volume_shape = (affs.shape[1], affs.shape[2], affs.shape[3])
         segmentation = np.zeros(volume_shape, dtype=np.uint64)
         find_fragments = True
     else:
+        # merging does not change the fragments, since the segmentation is 
+        # never extracted
         segmentation = fragments
         find_fragments = False
 
-    cdef WaterzState state = __initialize(affs, segmentation, gt, aff_threshold_low, aff_threshold_high, find_fragments)
+    cdef WaterzState state = __initialize(affs, segmentation, gt, aff_threshold_low, aff_threshold_high, find_fragments, scoring_expression)
+
+    cdef vector[MergeCurvePoint] curve
+    cdef float c_threshold = np.inf
+
+    try:
+        with nogil:
+            curve = getMergeCurve(state, c_threshold)
+    finally:
+        with nogil:
+            free(state)
+
+    cdef size_t n = curve.size()
+    cdef size_t i
+
+    scores = np.empty((n,), dtype=np.float32)
+    rand_split = np.empty((n,), dtype=np.float64)
+    rand_merge = np.empty((n,), dtype=np.float64)
+    voi_split = np.empty((n,), dtype=np.float64)
+    voi_merge = np.empty((n,), dtype=np.float64)
 
-    thresholds.sort()
-    for threshold in thresholds:
+    cdef float[:] scores_view = scores
+    cdef double[:] rand_split_view = rand_split
+    cdef double[:] rand_merge_view = rand_merge
+    cdef double[:] voi_split_view = voi_split
+    cdef double[:] voi_merge_view = voi_merge
 
-        merge_history = mergeUntil(state, threshold)
+    for i in range(n):
+        scores_view[i] = curve[i].score
+        rand_split_view[i] = curve[i].metrics.rand_split
+        rand_merge_view[i] = curve[i].metrics.rand_merge
+        voi_split_view[i] = curve[i].metrics.voi_split
+        voi_merge_view[i] = curve[i].metrics.voi_merge
+
+    return {
+        'score': scores,
+        'V_Rand_split': rand_split,
+        'V_Rand_merge': rand_merge,
+        'V_Info_split': voi_split,
+        'V_Info_merge': voi_merge,
+    }
+
+def merge_tree(
+        affs,
+        fragments=None,
+        aff_threshold_low=0.0001,
+        aff_threshold_high=0.9999,
+        scoring_expression=''):
 
-        result = (segmentation,)
+    if not affs.flags['C_CONTIGUOUS']:
+        logger.info("Creating memory-contiguous affinity arrray (avoid this by passing C_CONTIGUOUS arrays)")
+        affs = np.ascontiguousarray(affs)
 
-        if gt is not None:
+    if fragments is None:
+        volume_shape = (affs.shape[1], affs.shape[2], affs.shape[3])
+        segmentation = np.zeros(volume_shape, dtype=np.uint64)
+        find_fragments = True
+    else:
+        # merging does not change the fragments, since the segmentation is
+        # never extracted
+        segmentation = np.ascontiguousarray(fragments)
+        find_fragments = False
 
-            stats = {}
-            stats['V_Rand_split'] = state.metrics.rand_split
-            stats['V_Rand_merge'] = state.metrics.rand_merge
-            stats['V_Info_split'] = state.metrics.voi_split
-            stats['V_Info_merge'] = state.metrics.voi_merge
+    cdef WaterzState state = __initialize(affs, segmentation, None, aff_threshold_low, aff_threshold_high, find_fragments, scoring_expression)
+    cdef vector[MergeTreeNode] nodes
 
-            result += (stats,)
+    try:
+        with nogil:
+            nodes = getMergeTree(state)
+    finally:
+        with nogil:
+            free(state)
 
-        if return_merge_history:
+    cdef MergeTreeBuffer buffer = MergeTreeBuffer()
+    buffer.nodes.swap(nodes)
 
-            result += (merge_history,)
+    if buffer.nodes.size() == 0:
+        tree = np.zeros((0,), dtype=merge_tree_dtype)
+    else:
+        tree = np.frombuffer(buffer, dtype=merge_tree_dtype)
 
-        if return_region_graph:
+    return segmentation, tree
 
-            result += (getRegionGraph(state),)
+def __statistics(WaterzState state):
 
-        if len(result) == 1:
-            yield result[0]
-        else:
-            yield result
+    def timing(StageTiming t):
+        return {'wall': t.wall, 'cpu': t.cpu}
 
-    free(state)
+    return {
+        'timings': {
+            'fragments': timing(state.timings.fragments),
+            'region_graph': timing(state.timings.region_graph),
+            'ground_truth': timing(state.timings.ground_truth),
+            'merge': timing(state.timings.merge),
+            'extract_segmentation': timing(state.timings.extract_segmentation),
+        },
+        'counters': {
+            'pops': state.counters.pops,
+            'stale': state.counters.stale,
+            'deleted': state.counters.deleted,
+            'merges': state.counters.merges,
+            'peak_queue_size': state.counters.peak_queue_size,
+            'allocated_bytes': state.counters.allocated_bytes,
+            'dropped_events': state.counters.dropped_events,
+        }
+    }
 
 def __initialize(
         np.ndarray[np.float32_t, ndim=4] affs,
@@ -76,27 +433,73 @@ def __initialize(
         np.ndarray[uint32_t, ndim=3]     gt = None,
         aff_threshold_low  = 0.0001,
         aff_threshold_high = 0.9999,
-        find_fragments = True):
+        find_fragments = True,
+        scoring_expression = '',
+        pre_merge_threshold = None,
+        fragment_size_threshold = 0,
+        fragment_aff_threshold = 0.0,
+        fragments_in_xy = False):
 
     cdef float*    aff_data
     cdef uint64_t* segmentation_data
     cdef uint32_t* gt_data = NULL
+    cdef size_t    width = affs.shape[1]
+    cdef size_t    height = affs.shape[2]
+    cdef size_t    depth = affs.shape[3]
+    cdef float     c_aff_threshold_low = aff_threshold_low
+    cdef float     c_aff_threshold_high = aff_threshold_high
+    cdef bool      c_find_fragments = find_fragments
+    cdef string    c_scoring_expression = scoring_expression.encode()
+    cdef float     c_pre_merge_threshold = -np.inf
+    cdef size_t    c_fragment_size_threshold = fragment_size_threshold
+    cdef float     c_fragment_aff_threshold = fragment_aff_threshold
+    cdef bool      c_fragments_in_xy = fragments_in_xy
+    cdef WaterzState state
+
+    if pre_merge_threshold is not None:
+        c_pre_merge_threshold = pre_merge_threshold
+
+    setLogging(logger.isEnabledFor(logging.DEBUG))
 
     aff_data = &affs[0,0,0,0]
     segmentation_data = &segmentation[0,0,0]
     if gt is not None:
         gt_data = &gt[0,0,0]
 
-    return initialize(
-        affs.shape[1], affs.shape[2], affs.shape[3],
-        aff_data,
-        segmentation_data,
-        gt_data,
-        aff_threshold_low,
-        aff_threshold_high,
-        find_fragments)
+    with nogil:
+        state = initialize(
+            width, height, depth,
+            aff_data,
+            segmentation_data,
+            gt_data,
+            c_aff_threshold_low,
+            c_aff_threshold_high,
+            c_find_fragments,
+            c_scoring_expression,
+            c_pre_merge_threshold,
+            c_fragment_size_threshold,
+            c_fragment_aff_threshold,
+            c_fragments_in_xy)
+
+    return state
+
+cdef void* __data(np.ndarray array):
+
+    if array is None:
+        return NULL
+    return np.PyArray_DATA(array)
 
-cdef extern from "frontend_agglomerate.h":
+def __resume(string path, np.ndarray[uint64_t, ndim=3] segmentation):
+
+    cdef uint64_t* segmentation_data = &segmentation[0,0,0]
+    cdef WaterzState state
+
+    with nogil:
+        state = resumeState(path, segmentation_data)
+
+    return state
+
+cdef extern from "frontend_agglomerate.h" nogil:
 
     struct Metrics:
         double voi_split
@@ -115,10 +518,63 @@ cdef extern from "frontend_agglomerate.h":
         uint64_t v
         double score
 
-    struct WaterzState:
-        int     context
+    struct MergeTreeNode:
+        uint64_t parent
+        float    score
+
+    struct MergeCurvePoint:
+        float   score
         Metrics metrics
 
+    struct StageTiming:
+        double wall
+        double cpu
+
+    struct Timings:
+        StageTiming fragments
+        StageTiming region_graph
+        StageTiming ground_truth
+        StageTiming merge
+        StageTiming extract_segmentation
+
+    struct Counters:
+        size_t pops
+        size_t stale
+        size_t deleted
+        size_t merges
+        size_t peak_queue_size
+        size_t allocated_bytes
+        size_t dropped_events
+
+    struct Event:
+        uint64_t timestamp
+        uint64_t pop
+        uint64_t edge
+        uint64_t a
+        uint64_t b
+        float    old_score
+        float    new_score
+        uint8_t  type
+
+    ctypedef struct StatisticsSeedsType:
+        size_t          numNodes
+        size_t          numEdges
+        const uint64_t* regionSizes
+        const uint64_t* contactAreas
+        const float*    meanAffinities
+        const float*    maxAffinities
+        const float*    minAffinities
+        const uint32_t* histograms
+        size_t          histogramBins
+        const float*    maxKAffinities
+        size_t          maxK
+
+    struct WaterzState:
+        int      context
+        Metrics  metrics
+        Timings  timings
+        Counters counters
+
     WaterzState initialize(
             size_t          width,
             size_t          height,
@@ -128,12 +584,239 @@ cdef extern from "frontend_agglomerate.h":
             const uint32_t* groundtruth_data,
             float           affThresholdLow,
             float           affThresholdHigh,
-            bool            findFragments);
+            bool            findFragments,
+            const string&   scoringExpression,
+            float           preMergeThreshold,
+            size_t          fragmentSizeThreshold,
+            float           fragmentAffThreshold,
+            bool            fragmentsInXy) except +
+
+    WaterzState initializeFromRegionGraph(
+            size_t                     numNodes,
+            size_t                     numEdges,
+            const uint64_t*            edges,
+            const StatisticsSeedsType& seeds,
+            uint64_t*                  labels_data,
+            const string&              scoringExpression) except +
 
     vector[Merge] mergeUntil(
             WaterzState& state,
-            float        threshold)
+            float        threshold) except +
+
+    vector[MergeCurvePoint] getMergeCurve(
+            WaterzState& state,
+            float        threshold) except +
 
-    vector[ScoredEdge] getRegionGraph(WaterzState& state)
+    vector[ScoredEdge] getRegionGraph(WaterzState& state) except +
+
+    vector[MergeTreeNode] getMergeTree(WaterzState& state) except +
 
     void free(WaterzState& state)
+
+    void setLogging(bool enabled)
+
+    void setEventLog(
+            WaterzState& state,
+            size_t       capacity,
+            unsigned int sampling)
+
+    vector[Event] getEventLog(WaterzState& state)
+
+    void setMergeBatchSize(
+            WaterzState& state,
+            size_t       batchSize)
+
+    void saveState(
+            WaterzState&  state,
+            const string& path,
+            const string& info) except +
+
+    vector[size_t] getSavedShape(const string& path) except +
+
+    WaterzState resumeState(
+            const string& path,
+            uint64_t*     segmentation_data) except +
+
+cdef class MergeHistoryBuffer:
+    '''
+    Owns the merge history returned from C++ and exposes its memory through the
+    buffer protocol, such that numpy can wrap it without a copy.
+    '''
+
+    cdef vector[Merge] merges
+    cdef Py_ssize_t shape[1]
+
+    def __getbuffer__(self, Py_buffer* buffer, int flags):
+
+        self.shape[0] = self.merges.size()*sizeof(Merge)
+
+        buffer.buf = <char*>self.merges.data()
+        buffer.obj = self
+        buffer.len = self.shape[0]
+        buffer.readonly = 0
+        buffer.itemsize = 1
+        buffer.format = 'B'
+        buffer.ndim = 1
+        buffer.shape = self.shape
+        buffer.strides = NULL
+        buffer.suboffsets = NULL
+        buffer.internal = NULL
+
+    def __releasebuffer__(self, Py_buffer* buffer):
+        pass
+
+cdef class RegionGraphBuffer:
+    '''
+    Owns the region graph returned from C++ and exposes its memory through the
+    buffer protocol, such that numpy can wrap it without a copy.
+    '''
+
+    cdef vector[ScoredEdge] edges
+    cdef Py_ssize_t shape[1]
+
+    def __getbuffer__(self, Py_buffer* buffer, int flags):
+
+        self.shape[0] = self.edges.size()*sizeof(ScoredEdge)
+
+        buffer.buf = <char*>self.edges.data()
+        buffer.obj = self
+        buffer.len = self.shape[0]
+        buffer.readonly = 0
+        buffer.itemsize = 1
+        buffer.format = 'B'
+        buffer.ndim = 1
+        buffer.shape = self.shape
+        buffer.strides = NULL
+        buffer.suboffsets = NULL
+        buffer.internal = NULL
+
+    def __releasebuffer__(self, Py_buffer* buffer):
+        pass
+
+cdef class EventLogBuffer:
+    '''
+    Owns the events returned from C++ and exposes their memory through the
+    buffer protocol, such that numpy can wrap it without a copy.
+    '''
+
+    cdef vector[Event] events
+    cdef Py_ssize_t shape[1]
+
+    def __getbuffer__(self, Py_buffer* buffer, int flags):
+
+        self.shape[0] = self.events.size()*sizeof(Event)
+
+        buffer.buf = <char*>self.events.data()
+        buffer.obj = self
+        buffer.len = self.shape[0]
+        buffer.readonly = 0
+        buffer.itemsize = 1
+        buffer.format = 'B'
+        buffer.ndim = 1
+        buffer.shape = self.shape
+        buffer.strides = NULL
+        buffer.suboffsets = NULL
+        buffer.internal = NULL
+
+    def __releasebuffer__(self, Py_buffer* buffer):
+        pass
+
+cdef class MergeTreeBuffer:
+    '''
+    Owns the merge tree returned from C++ and exposes its memory through the
+    buffer protocol, such that numpy can wrap it without a copy.
+    '''
+
+    cdef vector[MergeTreeNode] nodes
+    cdef Py_ssize_t shape[1]
+
+    def __getbuffer__(self, Py_buffer* buffer, int flags):
+
+        self.shape[0] = self.nodes.size()*sizeof(MergeTreeNode)
+
+        buffer.buf = <char*>self.nodes.data()
+        buffer.obj = self
+        buffer.len = self.shape[0]
+        buffer.readonly = 0
+        buffer.itemsize = 1
+        buffer.format = 'B'
+        buffer.ndim = 1
+        buffer.shape = self.shape
+        buffer.strides = NULL
+        buffer.suboffsets = NULL
+        buffer.internal = NULL
+
+    def __releasebuffer__(self, Py_buffer* buffer):
+        pass
+
+cdef Merge __merge
+merge_dtype = np.dtype({
+    'names': ['a', 'b', 'c', 'score'],
+    'formats': [np.uint64, np.uint64, np.uint64, np.float32],
+    'offsets': [
+        <char*>&__merge.a - <char*>&__merge,
+        <char*>&__merge.b - <char*>&__merge,
+        <char*>&__merge.c - <char*>&__merge,
+        <char*>&__merge.score - <char*>&__merge],
+    'itemsize': sizeof(Merge)})
+
+cdef ScoredEdge __edge
+scored_edge_dtype = np.dtype({
+    'names': ['u', 'v', 'score'],
+    'formats': [np.uint64, np.uint64, np.float32],
+    'offsets': [
+        <char*>&__edge.u - <char*>&__edge,
+        <char*>&__edge.v - <char*>&__edge,
+        <char*>&__edge.score - <char*>&__edge],
+    'itemsize': sizeof(ScoredEdge)})
+
+cdef __merge_history_to_array(vector[Merge]& merges):
+
+    cdef MergeHistoryBuffer buffer = MergeHistoryBuffer()
+    buffer.merges.swap(merges)
+
+    if buffer.merges.size() == 0:
+        return np.zeros((0,), dtype=merge_dtype)
+    return np.frombuffer(buffer, dtype=merge_dtype)
+
+cdef __region_graph_to_array(vector[ScoredEdge]& edges):
+
+    cdef RegionGraphBuffer buffer = RegionGraphBuffer()
+    buffer.edges.swap(edges)
+
+    if buffer.edges.size() == 0:
+        return np.zeros((0,), dtype=scored_edge_dtype)
+    return np.frombuffer(buffer, dtype=scored_edge_dtype)
+
+cdef MergeTreeNode __node
+merge_tree_dtype = np.dtype({
+    'names': ['parent', 'score'],
+    'formats': [np.uint64, np.float32],
+    'offsets': [
+        <char*>&__node.parent - <char*>&__node,
+        <char*>&__node.score - <char*>&__node],
+    'itemsize': sizeof(MergeTreeNode)})
+
+cdef Event __event
+event_dtype = np.dtype({
+    'names': ['timestamp', 'pop', 'edge', 'a', 'b', 'old_score', 'new_score', 'type'],
+    'formats': [np.uint64, np.uint64, np.uint64, np.uint64, np.uint64, np.float32, np.float32, np.uint8],
+    'offsets': [
+        <char*>&__event.timestamp - <char*>&__event,
+        <char*>&__event.pop - <char*>&__event,
+        <char*>&__event.edge - <char*>&__event,
+        <char*>&__event.a - <char*>&__event,
+        <char*>&__event.b - <char*>&__event,
+        <char*>&__event.old_score - <char*>&__event,
+        <char*>&__event.new_score - <char*>&__event,
+        <char*>&__event.type - <char*>&__event],
+    'itemsize': sizeof(Event)})
+
+cdef __event_log_to_array(vector[Event]& events):
+
+    cdef EventLogBuffer buffer = EventLogBuffer()
+    buffer.events.swap(events)
+
+    if buffer.events.size() == 0:
+        return np.zeros((0,), dtype=event_dtype)
+    return np.frombuffer(buffer, dtype=event_dtype)
@@ -1,7 +1,9 @@
 #ifndef WATERZ_BIN_QUEUE_H__
 #define WATERZ_BIN_QUEUE_H__
 
-#include <queue>
+#include <deque>
+#include <stdexcept>
+#include <vector>
 #include "discretize.hpp"
 
 /**
@@ -16,19 +18,39 @@ class BinQueue {
 public:
 
 	BinQueue() :
-		_minBin(-1) {}
+		_minBin(-1),
+		_size(0) {}
 
 	void push(const T& element, ScoreType score) {
 
 		int i = discretize<int>(score, N);
 
-		_bins[i].push(element);
+		_bins[i].push_back(element);
+		_size++;
 		if (_minBin == -1)
 			_minBin = i;
 		else
 			_minBin = std::min(i, _minBin);
 	}
 
+	/**
+	 * Add the elements 0, ..., n-1 with scores[i] at once, in this order.
+	 */
+	template <typename Scores>
+	void build(std::size_t n, const Scores& scores) {
+
+		for (std::size_t i = 0; i < n; i++)
+			_bins[discretize<int>(scores[i], N)].push_back(T(i));
+		_size += n;
+
+		for (_minBin = 0; _minBin < N; _minBin++)
+			if (!_bins[_minBin].empty())
+				return;
+
+		// queue is empty
+		_minBin = -1;
+	}
+
 	const T& top() const {
 
 		return _bins[_minBin].front();
@@ -36,7 +58,8 @@ public:
 
 	void pop() {
 
-		_bins[_minBin].pop();
+		_bins[_minBin].pop_front();
+		_size--;
 
 		if (_bins[_minBin].empty()) {
 
@@ -57,22 +80,52 @@ public:
 
 	size_t size() const {
 
-		if (empty())
-			return 0;
+		return _size;
+	}
+
+	/**
+	 * Write the content of each bin in the order the elements will be popped.
+	 */
+	template <typename Writer>
+	void save(Writer& writer) const {
 
-		size_t sum = 0;
-		for (int i = _minBin; i < N; i++)
-			sum += _bins[i].size();
+		std::vector<std::vector<T>> bins(N);
+		for (int i = 0; i < N; i++)
+			bins[i].assign(_bins[i].begin(), _bins[i].end());
 
-		return sum;
+		writer.write(bins);
+	}
+
+	template <typename Reader>
+	void load(Reader& reader) {
+
+		std::vector<std::vector<T>> bins;
+		reader.read(bins);
+
+		if (bins.size() != N)
+			throw std::runtime_error("number of bins does not match queue");
+
+		_minBin = -1;
+		_size = 0;
+
+		for (int i = 0; i < N; i++) {
+
+			_bins[i].assign(bins[i].begin(), bins[i].end());
+			_size += bins[i].size();
+
+			if (_minBin == -1 && !bins[i].empty())
+				_minBin = i;
+		}
 	}
 
 private:
 
-	std::queue<T> _bins[N];
+	std::deque<T> _bins[N];
 
 	// smallest non-empty bin
 	int _minBin;
+
+	size_t _size;
 };
 
 #endif // WATERZ_BIN_QUEUE_H__
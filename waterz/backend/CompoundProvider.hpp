@@ -15,6 +15,9 @@ public:
 	typedef Head HeadType;
 	typedef CompoundProvider<Tail...> Parent;
 
+	static const bool NeedsVoxels = Head::NeedsVoxels || Parent::NeedsVoxels;
+	static const bool ThreadSafe = Head::ThreadSafe && Parent::ThreadSafe;
+
 	template <typename RegionGraphType>
 	CompoundProvider(RegionGraphType& regionGraph) :
 		Head(regionGraph),
@@ -41,6 +44,13 @@ public:
 		Parent::addVoxel(n, x, y, z);
 	}
 
+	template <typename SizeType>
+	inline void initNodeSizes(const SizeType* sizes, std::size_t numNodes) {
+
+		Head::initNodeSizes(sizes, numNodes);
+		Parent::initNodeSizes(sizes, numNodes);
+	}
+
 	template<typename NodeIdType>
 	inline bool notifyNodeMerge(NodeIdType from, NodeIdType to) {
 
@@ -56,6 +66,27 @@ public:
 				Head::notifyEdgeMerge(from, to) ||
 				Parent::notifyEdgeMerge(from, to));
 	}
+
+	template <typename Seeds>
+	inline void seed(const Seeds& seeds) {
+
+		Head::seed(seeds);
+		Parent::seed(seeds);
+	}
+
+	template <typename Writer>
+	inline void save(Writer& writer) const {
+
+		Head::save(writer);
+		Parent::save(writer);
+	}
+
+	template <typename Reader>
+	inline void load(Reader& reader) {
+
+		Head::load(reader);
+		Parent::load(reader);
+	}
 };
 
 
@@ -35,6 +35,27 @@ public:
 		return _contactArea[e];
 	}
 
+	template <typename Seeds>
+	inline void seed(const Seeds& seeds) {
+
+		const uint64_t* areas = Seeds::require(seeds.contactAreas, "contact areas");
+
+		for (std::size_t e = 0; e < seeds.numEdges; e++)
+			_contactArea[e] = areas[e];
+	}
+
+	template <typename Writer>
+	inline void save(Writer& writer) const {
+
+		_contactArea.save(writer);
+	}
+
+	template <typename Reader>
+	inline void load(Reader& reader) {
+
+		_contactArea.load(reader);
+	}
+
 private:
 
 	typename RegionGraphType::template EdgeMap<ValueType> _contactArea;
@@ -0,0 +1,167 @@
+#ifndef WATERZ_CONTEXT_REGISTRY_H__
+#define WATERZ_CONTEXT_REGISTRY_H__
+
+#include <atomic>
+#include <cassert>
+#include <memory>
+
+/**
+ * A lock-free registry of objects, addressed by integer IDs.
+ *
+ * IDs are allocated atomically and never reused. Each ID owns a slot with an
+ * atomic reference count. The registry holds one reference until remove() is
+ * called; get() hands out std::shared_ptrs that hold another reference each.
+ * Objects are deleted when the last reference is dropped, i.e., removing an
+ * object while another thread is still using it is safe.
+ *
+ * Slots are stored in chunks that are allocated on demand and never freed.
+ */
+template <typename T>
+class ContextRegistry {
+
+public:
+
+	typedef std::shared_ptr<T> Handle;
+
+	/**
+	 * Add an object to the registry, which takes ownership. Returns the ID of
+	 * the object.
+	 */
+	int add(T* object) {
+
+		int id = _nextId.fetch_add(1);
+		// NumChunks*ChunkSize covers all positive ints
+		assert(id >= 0);
+
+		Slot& slot = getSlot(id);
+		slot.object.store(object);
+		// one reference held by the registry
+		slot.refs.store(Alive);
+
+		return id;
+	}
+
+	/**
+	 * Get a handle to the object with the given ID. Returns an empty handle,
+	 * if there is no such object (or it was removed already).
+	 */
+	Handle get(int id) {
+
+		if (id < 0 || id >= _nextId.load())
+			return Handle();
+
+		Slot* slot = findSlot(id);
+		if (!slot)
+			return Handle();
+
+		// increase the reference count, unless the object was removed already
+		std::size_t refs = slot->refs.load();
+		do {
+
+			if (!(refs & Alive))
+				return Handle();
+
+		} while (!slot->refs.compare_exchange_weak(refs, refs + Ref));
+
+		return Handle(slot->object.load(), Release{this, id});
+	}
+
+	/**
+	 * Remove an object from the registry. It will be deleted as soon as no
+	 * handle to it exists anymore.
+	 */
+	void remove(int id) {
+
+		if (id < 0 || id >= _nextId.load())
+			return;
+
+		Slot* slot = findSlot(id);
+		if (!slot)
+			return;
+
+		std::size_t previous = slot->refs.fetch_and(~Alive);
+
+		// we were the last one holding a reference
+		if (previous == Alive)
+			destroy(*slot);
+	}
+
+	~ContextRegistry() {
+
+		for (int i = 0; i < NumChunks; i++)
+			delete[] _chunks[i].load();
+	}
+
+private:
+
+	// the lowest bit of the reference count indicates that the registry still
+	// holds the object
+	static const std::size_t Alive = 1;
+	static const std::size_t Ref   = 2;
+
+	static const int ChunkSize = 1 << 15;
+	static const int NumChunks = 1 << 16;
+
+	struct Slot {
+
+		std::atomic<T*>          object;
+		std::atomic<std::size_t> refs;
+	};
+
+	struct Release {
+
+		ContextRegistry* registry;
+		int id;
+
+		void operator()(T*) const {
+
+			Slot& slot = *registry->findSlot(id);
+
+			std::size_t previous = slot.refs.fetch_sub(Ref);
+
+			// the object was removed and this was the last handle
+			if (previous == Ref)
+				registry->destroy(slot);
+		}
+	};
+
+	void destroy(Slot& slot) {
+
+		delete slot.object.exchange(nullptr);
+	}
+
+	Slot* findSlot(int id) {
+
+		Slot* chunk = _chunks[id/ChunkSize].load();
+		if (!chunk)
+			return nullptr;
+
+		return &chunk[id%ChunkSize];
+	}
+
+	Slot& getSlot(int id) {
+
+		std::atomic<Slot*>& chunk = _chunks[id/ChunkSize];
+
+		Slot* current = chunk.load();
+		if (!current) {
+
+			// zero-initialized
+			Slot* fresh = new Slot[ChunkSize]();
+
+			if (chunk.compare_exchange_strong(current, fresh))
+				current = fresh;
+			else
+				// another thread was faster
+				delete[] fresh;
+		}
+
+		return current[id%ChunkSize];
+	}
+
+	std::atomic<int> _nextId{0};
+
+	std::atomic<Slot*> _chunks[NumChunks] = {};
+};
+
+#endif // WATERZ_CONTEXT_REGISTRY_H__
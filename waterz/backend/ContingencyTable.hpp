@@ -0,0 +1,194 @@
+#ifndef WATERZ_CONTINGENCY_TABLE_H__
+#define WATERZ_CONTINGENCY_TABLE_H__
+
+#include <cmath>
+#include <cstdint>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Overlap between a segmentation and a ground-truth, stored as one sparse row
+ * per segment. Computes the same Rand and VOI scores as compare_volumes(), but
+ * can be updated incrementally when two segments get merged, without
+ * revisiting the volumes.
+ *
+ * Like compare_volumes(), voxels with ground-truth label 0 are ignored.
+ */
+template <typename SegID, typename GtID>
+class ContingencyTable {
+
+public:
+
+	/**
+	 * Create a contingency table from a segmentation and ground-truth volume of
+	 * the same shape.
+	 */
+	template <typename SegmentationVolume, typename GroundTruthVolume>
+	ContingencyTable(
+			const SegmentationVolume& segmentation,
+			const GroundTruthVolume& groundtruth) :
+		_total(0),
+		_sumSquaresP(0),
+		_sumSquaresS(0),
+		_sumSquaresT(0),
+		_sumNLogNP(0),
+		_sumNLogNS(0),
+		_sumNLogNT(0) {
+
+		const auto* seg = segmentation.data();
+		const auto* gt  = groundtruth.data();
+
+		std::unordered_map<GtID, std::size_t> t;
+
+		for (std::size_t i = 0; i < segmentation.num_elements(); i++) {
+
+			if (!gt[i])
+				continue;
+
+			SegID s = seg[i];
+			if (s >= _rows.size()) {
+
+				_rows.resize(s + 1);
+				_rowSums.resize(s + 1, 0);
+			}
+
+			_rows[s][gt[i]]++;
+			_rowSums[s]++;
+			t[gt[i]]++;
+			_total++;
+		}
+
+		for (const auto& row : _rows)
+			for (const auto& p : row) {
+
+				_sumSquaresP += sq(p.second);
+				_sumNLogNP   += nlogn(p.second);
+			}
+
+		for (std::size_t s : _rowSums) {
+
+			_sumSquaresS += sq(s);
+			_sumNLogNS   += nlogn(s);
+		}
+
+		for (const auto& p : t) {
+
+			_sumSquaresT += sq(p.second);
+			_sumNLogNT   += nlogn(p.second);
+		}
+	}
+
+	/**
+	 * Merge the row of segment 'from' into segment 'to'. Only touches the
+	 * entries of the smaller of the two rows.
+	 */
+	void merge(SegID from, SegID to) {
+
+		if (from >= _rows.size() || _rowSums[from] == 0)
+			return;
+
+		if (to >= _rows.size()) {
+
+			_rows.resize(to + 1);
+			_rowSums.resize(to + 1, 0);
+		}
+
+		// iterate over the smaller row, keep the larger one in 'to'
+		if (_rows[from].size() > _rows[to].size())
+			std::swap(_rows[from], _rows[to]);
+
+		for (const auto& p : _rows[from]) {
+
+			std::size_t& n = _rows[to][p.first];
+
+			if (n > 0) {
+
+				_sumSquaresP -= sq(n) + sq(p.second);
+				_sumNLogNP   -= nlogn(n) + nlogn(p.second);
+
+				n += p.second;
+
+				_sumSquaresP += sq(n);
+				_sumNLogNP   += nlogn(n);
+
+			} else {
+
+				n = p.second;
+			}
+		}
+
+		std::size_t& sFrom = _rowSums[from];
+		std::size_t& sTo   = _rowSums[to];
+
+		_sumSquaresS -= sq(sFrom) + sq(sTo);
+		_sumNLogNS   -= nlogn(sFrom) + nlogn(sTo);
+
+		sTo += sFrom;
+		sFrom = 0;
+
+		_sumSquaresS += sq(sTo);
+		_sumNLogNS   += nlogn(sTo);
+
+		_rows[from].clear();
+	}
+
+	/**
+	 * Get the current (rand_split, rand_merge, voi_split, voi_merge).
+	 */
+	std::tuple<double,double,double,double> metrics() const {
+
+		if (_total == 0)
+			return std::make_tuple(0.0, 0.0, 0.0, 0.0);
+
+		double total = _total;
+		double logTotal = std::log2(total);
+
+		double rand_split = (double)_sumSquaresP/_sumSquaresT;
+		double rand_merge = (double)_sumSquaresP/_sumSquaresS;
+
+		// H(x) = log(N) - 1/N sum_i n_i log(n_i)
+		double H_st = logTotal - _sumNLogNP/total;
+		double H_s  = logTotal - _sumNLogNS/total;
+		double H_t  = logTotal - _sumNLogNT/total;
+
+		// H(s|t)
+		double voi_split = H_st - H_t;
+		// H(t|s)
+		double voi_merge = H_st - H_s;
+
+		return std::make_tuple(
+				rand_split,
+				rand_merge,
+				voi_split,
+				voi_merge);
+	}
+
+private:
+
+	static inline std::uint64_t sq(std::uint64_t n) { return n*n; }
+
+	static inline double nlogn(std::size_t n) { return (n ? n*std::log2((double)n) : 0.0); }
+
+	// overlap counts of each segment with ground-truth labels
+	std::vector<std::unordered_map<GtID, std::size_t>> _rows;
+
+	// size of each segment (ignoring ground-truth background)
+	std::vector<std::size_t> _rowSums;
+
+	std::size_t _total;
+
+	// sums of squares of overlaps, segment sizes, and ground-truth sizes (kept
+	// as integers, such that incremental updates are exact)
+	std::uint64_t _sumSquaresP;
+	std::uint64_t _sumSquaresS;
+	std::uint64_t _sumSquaresT;
+
+	// sums of n*log2(n) of the same
+	double _sumNLogNP;
+	double _sumNLogNS;
+	double _sumNLogNT;
+};
+
+#endif // WATERZ_CONTINGENCY_TABLE_H__
@@ -1,6 +1,7 @@
 #ifndef HISTOGRAM_H__
 #define HISTOGRAM_H__
 
+#include <algorithm>
 #include <vector>
 
 template <int Bins, typename T = int>
@@ -37,6 +38,22 @@ public:
 
 	T sum() const { return _sum; }
 
+	/**
+	 * Set the bins to the given Bins counts.
+	 */
+	template <typename U>
+	void assign(const U* counts) {
+
+		clear();
+		for (int i = 0; i < Bins; i++) {
+
+			_bins[i] = counts[i];
+			_sum += counts[i];
+			if (counts[i] != 0)
+				_lowestBin = std::min(_lowestBin, i);
+		}
+	}
+
 	void clear() {
 
 		_sum = 0;
@@ -1,6 +1,8 @@
 #ifndef WATERZ_HISTOGRAM_QUANTILE_PROVIDER_H__
 #define WATERZ_HISTOGRAM_QUANTILE_PROVIDER_H__
 
+#include <stdexcept>
+#include <string>
 #include "StatisticsProvider.hpp"
 #include "Histogram.hpp"
 #include "discretize.hpp"
@@ -61,6 +63,32 @@ public:
 		return undiscretize<Precision>(bin, Bins);
 	}
 
+	template <typename Seeds>
+	inline void seed(const Seeds& seeds) {
+
+		const uint32_t* histograms = Seeds::require(seeds.histograms, "histograms");
+
+		if (seeds.histogramBins != Bins)
+			throw std::invalid_argument(
+					"the statistics provider requires histograms with " +
+					std::to_string(Bins) + " bins");
+
+		for (std::size_t e = 0; e < seeds.numEdges; e++)
+			_histograms[e].assign(histograms + e*Bins);
+	}
+
+	template <typename Writer>
+	inline void save(Writer& writer) const {
+
+		_histograms.save(writer);
+	}
+
+	template <typename Reader>
+	inline void load(Reader& reader) {
+
+		_histograms.load(reader);
+	}
+
 private:
 
 	typename RegionGraphType::template EdgeMap<Histogram<Bins>> _histograms;
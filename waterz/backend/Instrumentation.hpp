@@ -0,0 +1,67 @@
+#ifndef WATERZ_INSTRUMENTATION_H__
+#define WATERZ_INSTRUMENTATION_H__
+
+#include <chrono>
+#include <cstddef>
+#include <ctime>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+/**
+ * Measures the wall and CPU time since its creation. CPU time is measured for 
+ * the calling thread where supported, such that concurrent agglomerations do 
+ * not add to each other.
+ */
+class StageTimer {
+
+public:
+
+	StageTimer() :
+		_wall(std::chrono::steady_clock::now()),
+		_cpu(cpuTime()) {}
+
+	double wallSeconds() const {
+
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - _wall).count();
+	}
+
+	double cpuSeconds() const {
+
+		return cpuTime() - _cpu;
+	}
+
+private:
+
+	static double cpuTime() {
+
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+		timespec t;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+		return t.tv_sec + t.tv_nsec*1e-9;
+#else
+		return double(std::clock())/CLOCKS_PER_SEC;
+#endif
+	}
+
+	std::chrono::steady_clock::time_point _wall;
+	double _cpu;
+};
+
+/**
+ * The number of bytes currently allocated through malloc (by the whole 
+ * process). Returns 0 where this is not supported.
+ */
+inline std::size_t allocatedBytes() {
+
+#if defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 33)
+	struct mallinfo2 info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+#endif
+#endif
+	return 0;
+}
+
+#endif // WATERZ_INSTRUMENTATION_H__
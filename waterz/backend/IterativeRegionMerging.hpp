@@ -6,10 +6,15 @@
 #include <map>
 #include <queue>
 #include <cassert>
+#include <cstdint>
+#include <initializer_list>
 #include <limits>
+#include <stdexcept>
 
 #include "RegionGraph.hpp"
 #include "PriorityQueue.hpp"
+#include "Parallel.hpp"
+#include "Logging.hpp"
 
 template <typename NodeIdType, typename ScoreType, template <typename T, typename S> class QueueType = PriorityQueue>
 class IterativeRegionMerging {
@@ -26,8 +31,10 @@ public:
 	IterativeRegionMerging(RegionGraphType& initialRegionGraph) :
 		_regionGraph(initialRegionGraph),
 		_edgeScores(initialRegionGraph),
-		_deleted(initialRegionGraph),
 		_stale(initialRegionGraph),
+		_deleted(initialRegionGraph),
+		_nodeVersions(initialRegionGraph),
+		_scoredVersions(initialRegionGraph),
 		_mergedUntil(std::numeric_limits<ScoreType>::lowest()) {}
 
 	/**
@@ -42,23 +49,24 @@ public:
 
 		if (threshold <= _mergedUntil) {
 
-			std::cout << "already merged until " << threshold << ", skipping" << std::endl;
+			WATERZ_LOG << "already merged until " << threshold << ", skipping" << std::endl;
 			return 0;
 		}
 
 		// compute scores of each edge not scored so far
 		if (_mergedUntil == std::numeric_limits<ScoreType>::lowest()) {
 
-			std::cout << "computing initial scores" << std::endl;
+			WATERZ_LOG << "computing initial scores" << std::endl;
 
-			for (EdgeIdType e = 0; e < _regionGraph.edges().size(); e++)
-				scoreEdge(e, edgeScoringFunction);
+			scoreAllEdges(edgeScoringFunction);
 		}
 
-		std::cout << "merging until " << threshold << std::endl;
+		WATERZ_LOG << "merging until " << threshold << std::endl;
+
+		if (!_edgeQueue.empty()) {
 
-		if (!_edgeQueue.empty())
-			std::cout << "min edge score " << _edgeScores[_edgeQueue.top()] << std::endl;
+			WATERZ_LOG << "min edge score " << _edgeScores[_edgeQueue.top()] << std::endl;
+		}
 
 		// while there are still unhandled edges
 		std::size_t merged = 0;
@@ -73,7 +81,7 @@ public:
 			// more expensive)
 			if (score >= threshold) {
 
-				std::cout << "threshold exceeded" << std::endl;
+				WATERZ_LOG << "threshold exceeded" << std::endl;
 				break;
 			}
 
@@ -87,7 +95,7 @@ public:
 				continue;
 			}
 
-			if (_stale[next]) {
+			if (isStale(next)) {
 
 				// if we encountered a stale edge, recompute it's score and 
 				// place it back in the queue
@@ -101,22 +109,268 @@ public:
 			}
 
 			NodeIdType newRegion = mergeRegions(next, statisticsProvider);
+			_rootPaths[_regionGraph.edge(next).v] = newRegion;
 			merged++;
 
 			visitor.onMerge(
+					next,
 					_regionGraph.edge(next).u,
 					_regionGraph.edge(next).v,
 					newRegion,
 					score);
 		}
 
-		std::cout << "merged " << merged << " edges" << std::endl;
+		WATERZ_LOG << "merged " << merged << " edges" << std::endl;
+
+		_mergedUntil = threshold;
+
+		return merged;
+	}
+
+	/**
+	 * Same as mergeUntil(), but merges independent edges in parallel.
+	 *
+	 * Up to batchSize edges below the threshold are taken from the queue at 
+	 * once (deleted and stale edges are handled as usual). Of those, an edge 
+	 * is selected if no edge incident to its regions has a lower score, and 
+	 * none of its regions or their neighbors are part of an edge selected 
+	 * before. Selected edges are merged concurrently (serially, if the 
+	 * statistics provider is not ThreadSafe), the others are put back into 
+	 * the queue.
+	 *
+	 * The result is the same as the one of mergeUntil(), up to the order of 
+	 * edges with equal scores and rounding, if merges never make an edge 
+	 * cheaper than the cheapest of the edges it was merged from. This is the 
+	 * case if the score of a merged edge lies between the scores of its 
+	 * parts (like for mean, quantile, min, and max affinities), also when 
+	 * multiplied with node statistics that only grow with merges (like the 
+	 * size of the smaller region). Then, cheaper edges do not touch the 
+	 * regions of a selected edge, and merging them later cannot make the 
+	 * edges around it cheaper than it. Scores that decrease as edges grow 
+	 * (like 1 - quantile75(aff)*log(contact_area)) do not have this property: 
+	 * an edge that was put back because of a selected neighbor can, once 
+	 * merged, make an edge next to the selected one cheaper than it, such 
+	 * that the order of merges differs from mergeUntil().
+	 *
+	 * For queues that only approximate the order of scores (like the 
+	 * BinQueue), edges are selected by their exact scores, which can change 
+	 * the result within the approximation. The result is deterministic and 
+	 * does not depend on the number of threads, since edges are selected 
+	 * sequentially.
+	 *
+	 * The visitor is called from the calling thread. onMerge() is called for 
+	 * the selected edges of a batch in queue order, after all edges of the 
+	 * batch were popped, such that visitors have to take the merged edge 
+	 * from onMerge() instead of the last onPop(). Edges that are put back are 
+	 * reported to onPutBack() (after all edges of the batch were popped as 
+	 * well), and popped (and reported to onPop()) again later.
+	 */
+	template <typename EdgeScoringFunction, typename StatisticsProviderType, typename Visitor>
+	std::size_t mergeUntilInBatches(
+			EdgeScoringFunction& edgeScoringFunction,
+			StatisticsProviderType& statisticsProvider,
+			ScoreType threshold,
+			Visitor& visitor,
+			std::size_t batchSize) {
+
+		if (threshold <= _mergedUntil) {
+
+			WATERZ_LOG << "already merged until " << threshold << ", skipping" << std::endl;
+			return 0;
+		}
+
+		if (_mergedUntil == std::numeric_limits<ScoreType>::lowest()) {
+
+			WATERZ_LOG << "computing initial scores" << std::endl;
+
+			scoreAllEdges(edgeScoringFunction);
+		}
+
+		WATERZ_LOG << "merging until " << threshold << " in batches of " << batchSize << std::endl;
+
+		std::vector<EdgeIdType> candidates;
+		std::vector<EdgeIdType> selected;
+		std::vector<EdgeType>   mergedNodes;
+
+		// nodes that are part of or next to a selected edge
+		std::vector<char>       marked(_regionGraph.numNodes(), false);
+		std::vector<NodeIdType> markedNodes;
+
+		std::size_t merged = 0;
+		while (true) {
+
+			candidates.clear();
+			while (!_edgeQueue.empty() && candidates.size() < std::max(batchSize, std::size_t(1))) {
+
+				EdgeIdType next = _edgeQueue.top();
+				ScoreType score = _edgeScores[next];
+
+				if (score >= threshold)
+					break;
+
+				_edgeQueue.pop();
+
+				visitor.onPop(next, score);
+
+				if (_deleted[next]) {
+
+					visitor.onDeletedEdgeFound(next);
+					continue;
+				}
+
+				if (isStale(next)) {
+
+					ScoreType newScore = scoreEdge(next, edgeScoringFunction);
+					_stale[next] = false;
+
+					visitor.onStaleEdgeFound(next, score, newScore);
+
+					continue;
+				}
+
+				candidates.push_back(next);
+			}
+
+			if (candidates.empty())
+				break;
+
+			// the first candidate is always selected, such that every batch 
+			// makes progress
+			selected.clear();
+			for (std::size_t i = 0; i < candidates.size(); i++) {
+
+				EdgeIdType e = candidates[i];
+
+				if ((i == 0 || isLocalMinimum(e)) && markNeighborhood(e, marked, markedNodes)) {
+
+					selected.push_back(e);
+
+				} else {
+
+					_edgeQueue.push(e, _edgeScores[e]);
+					visitor.onPutBack(e, _edgeScores[e]);
+				}
+			}
+
+			for (NodeIdType n : markedNodes)
+				marked[n] = false;
+			markedNodes.clear();
+
+			// endpoints before merging, for the callbacks
+			mergedNodes.clear();
+			for (EdgeIdType e : selected)
+				mergedNodes.push_back(_regionGraph.edge(e));
+
+			// the statistics of disjoint regions and edges are updated 
+			// concurrently, which requires a ThreadSafe provider
+			bool parallel = StatisticsProviderType::ThreadSafe;
+
+			// a merge costs O(deg(b)) and batches are small, such that a few 
+			// merges per thread are enough to pay for starting it
+			parallelForIf(parallel, selected.size(), [this, &selected, &statisticsProvider](std::size_t begin, std::size_t end) {
+
+				for (std::size_t i = begin; i < end; i++)
+					mergeRegions(selected[i], statisticsProvider);
+
+			}, 16);
+
+			for (std::size_t i = 0; i < selected.size(); i++) {
+
+				NodeIdType a = mergedNodes[i].u;
+				NodeIdType b = mergedNodes[i].v;
+
+				_rootPaths[b] = a;
+				merged++;
+
+				visitor.onMerge(selected[i], a, b, a, _edgeScores[selected[i]]);
+			}
+		}
+
+		WATERZ_LOG << "merged " << merged << " edges" << std::endl;
 
 		_mergedUntil = threshold;
 
 		return merged;
 	}
 
+	/**
+	 * The number of edges in the queue, including stale and deleted ones.
+	 */
+	std::size_t queueSize() const {
+
+		return _edgeQueue.size();
+	}
+
+	/**
+	 * The threshold merged until so far.
+	 */
+	ScoreType mergedUntil() const {
+
+		return _mergedUntil;
+	}
+
+	/**
+	 * Write the state of merging (edge scores, queue, merge-tree, and merge 
+	 * level). The region graph and statistics have to be saved separately.
+	 */
+	template <typename Writer>
+	void save(Writer& writer) const {
+
+		std::vector<NodeIdType> nodes;
+		std::vector<NodeIdType> parents;
+		nodes.reserve(_rootPaths.size());
+		parents.reserve(_rootPaths.size());
+		for (const auto& p : _rootPaths) {
+
+			nodes.push_back(p.first);
+			parents.push_back(p.second);
+		}
+
+		_edgeScores.save(writer);
+		_stale.save(writer);
+		_deleted.save(writer);
+		_nodeVersions.save(writer);
+		_scoredVersions.save(writer);
+		_edgeQueue.save(writer);
+		writer.write(nodes);
+		writer.write(parents);
+		writer.write(_mergedUntil);
+	}
+
+	/**
+	 * Read the state written by save(). The region graph this region merging 
+	 * was created for has to be the one that was saved with it.
+	 */
+	template <typename Reader>
+	void load(Reader& reader) {
+
+		std::vector<NodeIdType> nodes;
+		std::vector<NodeIdType> parents;
+
+		_edgeScores.load(reader);
+		_stale.load(reader);
+		_deleted.load(reader);
+		_nodeVersions.load(reader);
+		_scoredVersions.load(reader);
+		_edgeQueue.load(reader);
+		reader.read(nodes);
+		reader.read(parents);
+		reader.read(_mergedUntil);
+
+		if (nodes.size() != parents.size())
+			throw std::runtime_error("corrupt merge-tree");
+
+		_rootPaths.clear();
+		for (std::size_t i = 0; i < nodes.size(); i++) {
+
+			if (nodes[i] >= _regionGraph.numNodes() || parents[i] >= _regionGraph.numNodes())
+				throw std::runtime_error("corrupt merge-tree");
+
+			// nodes are sorted, inserting at the end is constant time
+			_rootPaths.emplace_hint(_rootPaths.end(), nodes[i], parents[i]);
+		}
+	}
+
 	/**
 	 * Get the segmentation corresponding to the current merge level.
 	 *
@@ -145,8 +399,8 @@ public:
 				continue;
 
 			ScoreType score;
-			if (_stale[e])
-				score = scoreEdge(e, edgeScoringFunction);
+			if (isStale(e))
+				score = edgeScoringFunction(e);
 			else
 				score = _edgeScores[e];
 
@@ -166,7 +420,8 @@ public:
 private:
 
 	/**
-	 * Merge regions a and b.
+	 * Merge regions a and b. Only changes a, b, their neighbors, and the 
+	 * edges between them. The caller has to set the root path of b.
 	 */
 	template <typename StatisticsProviderType>
 	NodeIdType mergeRegions(
@@ -179,21 +434,17 @@ private:
 		// assign new node a = a + b
 		bool nodeStatisticsChanged = statisticsProvider.notifyNodeMerge(b, a);
 
-		// set path
-		_rootPaths[b] = a;
-
-		if (nodeStatisticsChanged) {
-
-			// mark all incident edges of a as stale...
-			for (EdgeIdType neighborEdge : _regionGraph.incEdges(a))
-				_stale[neighborEdge] = true;
-		}
+		// incident edges of a become stale lazily, see isStale()...
+		if (nodeStatisticsChanged)
+			_nodeVersions[a]++;
 
 		// ...and update incident edges of b
 		std::vector<EdgeIdType> neighborEdges = _regionGraph.incEdges(b);
 		for (EdgeIdType neighborEdge : neighborEdges) {
 
-			if (neighborEdge == e)
+			// skip e and edges merged before, which stay in the incidence 
+			// lists
+			if (neighborEdge == e || _deleted[neighborEdge])
 				continue;
 
 			NodeIdType neighbor = _regionGraph.getOpposite(b, neighborEdge);
@@ -209,11 +460,7 @@ private:
 
 				// We encountered an exclusive neighbor of b.
 
-				_regionGraph.moveEdge(neighborEdge, a, neighbor);
-				assert(_regionGraph.findEdge(a, neighbor) == neighborEdge);
-
-				if (nodeStatisticsChanged)
-					_stale[neighborEdge] = true;
+				moveEdge(neighborEdge, a, neighbor, nodeStatisticsChanged);
 
 			} else {
 
@@ -247,20 +494,93 @@ private:
 					bool edgeStatisticChanged = statisticsProvider.notifyEdgeMerge(aNeighborEdge, neighborEdge);
 
 					_regionGraph.removeEdge(aNeighborEdge);
-					_regionGraph.moveEdge(neighborEdge, a, neighbor);
-					assert(_regionGraph.findEdge(a, neighbor) == neighborEdge);
-
-					if (edgeStatisticChanged)
-						_stale[neighborEdge] = true;
+					moveEdge(neighborEdge, a, neighbor, edgeStatisticChanged);
 					_deleted[aNeighborEdge] = true;
 				}
 			}
 		}
 
+		// the merged edge is not needed anymore, it stays in the incidence 
+		// list of a (removing it would cost O(deg(a)) per merge), but is 
+		// skipped as deleted
+		_deleted[e] = true;
+
 		// the new node
 		return a;
 	}
 
+	/**
+	 * Connect edge e to nodes u and v instead. The edge gets stale, if stale 
+	 * is true or it was stale already.
+	 */
+	void moveEdge(EdgeIdType e, NodeIdType u, NodeIdType v, bool stale) {
+
+		// the node versions of the new nodes are unrelated to the ones the 
+		// edge was scored with, keep the staleness in the flag instead
+		_stale[e] = isStale(e) || stale;
+
+		_regionGraph.moveEdge(e, u, v);
+		assert(_regionGraph.findEdge(u, v) == e);
+
+		_scoredVersions[e] = nodeVersions(e);
+	}
+
+	/**
+	 * Check whether no edge incident to the regions of e is cheaper than e.  
+	 * Scores of stale edges are lower bounds, which makes the check 
+	 * conservative.
+	 */
+	bool isLocalMinimum(EdgeIdType e) const {
+
+		ScoreType score = _edgeScores[e];
+
+		for (NodeIdType n : {_regionGraph.edge(e).u, _regionGraph.edge(e).v})
+			for (EdgeIdType neighborEdge : _regionGraph.incEdges(n))
+				if (!_deleted[neighborEdge] && _edgeScores[neighborEdge] < score)
+					return false;
+
+		return true;
+	}
+
+	/**
+	 * Mark the regions of e and their neighbors, unless one of them is marked 
+	 * already. Returns true, if the nodes got marked.
+	 */
+	bool markNeighborhood(
+			EdgeIdType e,
+			std::vector<char>& marked,
+			std::vector<NodeIdType>& markedNodes) const {
+
+		for (NodeIdType n : {_regionGraph.edge(e).u, _regionGraph.edge(e).v}) {
+
+			if (marked[n])
+				return false;
+
+			for (EdgeIdType neighborEdge : _regionGraph.incEdges(n))
+				if (!_deleted[neighborEdge] && marked[_regionGraph.getOpposite(n, neighborEdge)])
+					return false;
+		}
+
+		for (NodeIdType n : {_regionGraph.edge(e).u, _regionGraph.edge(e).v}) {
+
+			for (EdgeIdType neighborEdge : _regionGraph.incEdges(n)) {
+
+				if (_deleted[neighborEdge])
+					continue;
+
+				NodeIdType neighbor = _regionGraph.getOpposite(n, neighborEdge);
+
+				if (!marked[neighbor]) {
+
+					marked[neighbor] = true;
+					markedNodes.push_back(neighbor);
+				}
+			}
+		}
+
+		return true;
+	}
+
 	/**
 	 * Score edge e.
 	 */
@@ -270,11 +590,58 @@ private:
 		ScoreType score = edgeScoringFunction(e);
 
 		_edgeScores[e] = score;
+		_scoredVersions[e] = nodeVersions(e);
 		_edgeQueue.push(e, score);
 
 		return score;
 	}
 
+	/**
+	 * The sum of the versions of the nodes of edge e. Since versions only 
+	 * increase, the sum changes whenever the statistics of one of the nodes 
+	 * changed.
+	 */
+	inline uint64_t nodeVersions(EdgeIdType e) const {
+
+		return
+				uint64_t(_nodeVersions[_regionGraph.edge(e).u]) +
+				uint64_t(_nodeVersions[_regionGraph.edge(e).v]);
+	}
+
+	/**
+	 * An edge is stale, if its statistics or the statistics of one of its 
+	 * nodes changed since it was scored.
+	 */
+	inline bool isStale(EdgeIdType e) const {
+
+		return _stale[e] || _scoredVersions[e] != nodeVersions(e);
+	}
+
+	/**
+	 * Score all edges and put them in the queue at once. Edges are scored in 
+	 * parallel, which requires that the scoring function is safe to call 
+	 * concurrently. This is the case if its statistics provider is 
+	 * ThreadSafe, otherwise edges are scored serially.
+	 */
+	template <typename EdgeScoringFunction>
+	void scoreAllEdges(EdgeScoringFunction& edgeScoringFunction) {
+
+		std::size_t numEdges = _regionGraph.numEdges();
+
+		bool parallel = EdgeScoringFunction::StatisticsProviderType::ThreadSafe;
+
+		parallelForIf(parallel, numEdges, [this, &edgeScoringFunction](std::size_t begin, std::size_t end) {
+
+			for (EdgeIdType e = begin; e < end; e++) {
+
+				_edgeScores[e] = edgeScoringFunction(e);
+				_scoredVersions[e] = nodeVersions(e);
+			}
+		});
+
+		_edgeQueue.build(numEdges, _edgeScores);
+	}
+
 	inline bool isRoot(NodeIdType id) {
 
 		// if there is no root path, it is a root
@@ -313,8 +680,19 @@ private:
 	// the score of each edge
 	typename RegionGraphType::template EdgeMap<ScoreType> _edgeScores;
 
-	typename RegionGraphType::template EdgeMap<bool> _stale;
-	typename RegionGraphType::template EdgeMap<bool> _deleted;
+	// edges whose statistics changed since they were scored, and edges that 
+	// were merged into another edge or whose regions got merged
+	//
+	// char instead of bool, such that merges in parallel can set flags of 
+	// different edges concurrently
+	typename RegionGraphType::template EdgeMap<char> _stale;
+	typename RegionGraphType::template EdgeMap<char> _deleted;
+
+	// incremented whenever the statistics of a node change
+	typename RegionGraphType::template NodeMap<uint32_t> _nodeVersions;
+
+	// the sum of the node versions of each edge when it was scored
+	typename RegionGraphType::template EdgeMap<uint64_t> _scoredVersions;
 
 	// sorted list of edges indices, cheapest edge first
 	QueueType<EdgeIdType, ScoreType> _edgeQueue;
@@ -0,0 +1,33 @@
+#ifndef WATERZ_LOGGING_H__
+#define WATERZ_LOGGING_H__
+
+#include <atomic>
+#include <iostream>
+
+/**
+ * Whether progress messages of the backend are printed. Off by default.
+ */
+inline std::atomic<bool>& loggingEnabled() {
+
+	static std::atomic<bool> enabled(false);
+	return enabled;
+}
+
+inline void setLogging(bool enabled) {
+
+	loggingEnabled().store(enabled, std::memory_order_relaxed);
+}
+
+/**
+ * Stream for progress messages. The message is not even formatted if logging 
+ * is disabled:
+ *
+ *   WATERZ_LOG << "merged " << merged << " edges" << std::endl;
+ *
+ * The guard is a loop that runs at most once, such that an else following a 
+ * WATERZ_LOG statement binds to the caller's if.
+ */
+#define WATERZ_LOG \
+	for (bool _waterzLog = loggingEnabled().load(std::memory_order_relaxed); _waterzLog; _waterzLog = false) std::cout
+
+#endif // WATERZ_LOGGING_H__
@@ -38,6 +38,27 @@ public:
 		return _maxAffinities[e];
 	}
 
+	template <typename Seeds>
+	inline void seed(const Seeds& seeds) {
+
+		const Precision* maxima = Seeds::require(seeds.maxAffinities, "max affinities");
+
+		for (std::size_t e = 0; e < seeds.numEdges; e++)
+			_maxAffinities[e] = maxima[e];
+	}
+
+	template <typename Writer>
+	inline void save(Writer& writer) const {
+
+		_maxAffinities.save(writer);
+	}
+
+	template <typename Reader>
+	inline void load(Reader& reader) {
+
+		_maxAffinities.load(reader);
+	}
+
 private:
 
 	typename RegionGraphType::template EdgeMap<ValueType> _maxAffinities;
@@ -1,6 +1,7 @@
 #ifndef WATERZ_MAX_K_AFFINITY_PROVIDER_H__
 #define WATERZ_MAX_K_AFFINITY_PROVIDER_H__
 
+#include <limits>
 #include "MaxKValues.hpp"
 #include "StatisticsProvider.hpp"
 
@@ -31,6 +32,29 @@ public:
 		return _maxKValues[e];
 	}
 
+	template <typename Seeds>
+	inline void seed(const Seeds& seeds) {
+
+		const Precision* values = Seeds::require(seeds.maxKAffinities, "max-k affinities");
+
+		for (std::size_t e = 0; e < seeds.numEdges; e++)
+			for (std::size_t k = 0; k < seeds.maxK; k++)
+				if (values[e*seeds.maxK + k] != std::numeric_limits<Precision>::lowest())
+					_maxKValues[e].push(values[e*seeds.maxK + k]);
+	}
+
+	template <typename Writer>
+	inline void save(Writer& writer) const {
+
+		_maxKValues.save(writer);
+	}
+
+	template <typename Reader>
+	inline void load(Reader& reader) {
+
+		_maxKValues.load(reader);
+	}
+
 private:
 
 	typename RegionGraphType::template EdgeMap<MaxKValues<Precision,K>> _maxKValues;
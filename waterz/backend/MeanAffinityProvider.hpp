@@ -46,6 +46,33 @@ public:
 		return _meanAffinities[e];
 	}
 
+	template <typename Seeds>
+	inline void seed(const Seeds& seeds) {
+
+		const uint64_t* counts = Seeds::require(seeds.contactAreas, "contact areas");
+		const Precision* means = Seeds::require(seeds.meanAffinities, "mean affinities");
+
+		for (std::size_t e = 0; e < seeds.numEdges; e++) {
+
+			_numValues[e] = counts[e];
+			_meanAffinities[e] = means[e];
+		}
+	}
+
+	template <typename Writer>
+	inline void save(Writer& writer) const {
+
+		_numValues.save(writer);
+		_meanAffinities.save(writer);
+	}
+
+	template <typename Reader>
+	inline void load(Reader& reader) {
+
+		_numValues.load(reader);
+		_meanAffinities.load(reader);
+	}
+
 private:
 
 	typename RegionGraphType::template EdgeMap<size_t> _numValues;
@@ -0,0 +1,136 @@
+#ifndef WATERZ_MERGE_TREE_H__
+#define WATERZ_MERGE_TREE_H__
+
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+/**
+ * A merge tree (dendrogram) over the initial regions. Each region points to
+ * the region it got merged into, together with the level of the merge.
+ * Regions that were never merged are their own parents, with an infinite
+ * level.
+ *
+ * Levels are monotone: the level of a merge is the highest score popped from
+ * the queue until (and including) this merge. Merging until a threshold t
+ * performs exactly the merges with level < t, which makes it possible to
+ * derive the segmentation for any threshold from the tree.
+ */
+template <typename NodeIdType, typename ScoreType>
+class MergeTree {
+
+public:
+
+	MergeTree(std::size_t numNodes) :
+		_parents(numNodes),
+		_levels(numNodes, std::numeric_limits<ScoreType>::infinity()) {
+
+		for (std::size_t i = 0; i < numNodes; i++)
+			_parents[i] = i;
+	}
+
+	/**
+	 * Record that region 'from' got merged into 'into' at the given level.
+	 */
+	void merge(NodeIdType from, NodeIdType into, ScoreType level) {
+
+		_parents[from] = into;
+		_levels[from] = level;
+	}
+
+	std::size_t size() const { return _parents.size(); }
+
+	const std::vector<NodeIdType>& parents() const { return _parents; }
+	const std::vector<ScoreType>& levels() const { return _levels; }
+
+private:
+
+	std::vector<NodeIdType> _parents;
+	std::vector<ScoreType>  _levels;
+};
+
+/**
+ * Get a lookup table from initial regions to the regions they are part of
+ * after merging until the given threshold.
+ *
+ * @param parents [in]
+ *              The parent of each region, see MergeTree.
+ * @param levels [in]
+ *              The level of the merge of each region into its parent.
+ * @param numNodes [in]
+ *              The number of regions.
+ * @param threshold [in]
+ *              The threshold to cut the tree at.
+ * @param lut [out]
+ *              The lookup table, will be resized to numNodes.
+ */
+template <typename NodeIdType, typename ScoreType>
+void
+cutMergeTree(
+		const NodeIdType* parents,
+		const ScoreType* levels,
+		std::size_t numNodes,
+		ScoreType threshold,
+		std::vector<NodeIdType>& lut) {
+
+	// lut[i] == numNodes marks regions that were not visited, yet
+	const NodeIdType unknown = numNodes;
+	lut.assign(numNodes, unknown);
+
+	std::vector<NodeIdType> path;
+
+	for (std::size_t i = 0; i < numNodes; i++) {
+
+		if (lut[i] != unknown)
+			continue;
+
+		// walk up until we reach a region that is not merged at this
+		// threshold, or whose root we know already
+		NodeIdType node = i;
+		while (lut[node] == unknown && levels[node] < threshold && parents[node] != node) {
+
+			path.push_back(node);
+			node = parents[node];
+		}
+
+		NodeIdType root = (lut[node] == unknown ? node : lut[node]);
+		lut[node] = root;
+
+		for (NodeIdType n : path)
+			lut[n] = root;
+		path.clear();
+	}
+}
+
+/**
+ * Get the segmentation for the given threshold from a merge tree and the
+ * initial regions in a single pass over the voxels.
+ *
+ * @param parents, levels, numNodes, threshold [in]
+ *              See cutMergeTree().
+ * @param fragments [in]
+ *              The initial regions.
+ * @param segmentation [out]
+ *              The segmentation, can be the same as fragments.
+ * @param numVoxels [in]
+ *              The number of voxels in fragments and segmentation.
+ */
+template <typename NodeIdType, typename ScoreType>
+void
+cutMergeTree(
+		const NodeIdType* parents,
+		const ScoreType* levels,
+		std::size_t numNodes,
+		ScoreType threshold,
+		const NodeIdType* fragments,
+		NodeIdType* segmentation,
+		std::size_t numVoxels) {
+
+	std::vector<NodeIdType> lut;
+	cutMergeTree(parents, levels, numNodes, threshold, lut);
+
+	for (std::size_t i = 0; i < numVoxels; i++)
+		segmentation[i] = lut[fragments[i]];
+}
+
+#endif // WATERZ_MERGE_TREE_H__
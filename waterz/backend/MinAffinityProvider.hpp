@@ -38,6 +38,27 @@ public:
 		return _minAffinities[e];
 	}
 
+	template <typename Seeds>
+	inline void seed(const Seeds& seeds) {
+
+		const Precision* minima = Seeds::require(seeds.minAffinities, "min affinities");
+
+		for (std::size_t e = 0; e < seeds.numEdges; e++)
+			_minAffinities[e] = minima[e];
+	}
+
+	template <typename Writer>
+	inline void save(Writer& writer) const {
+
+		_minAffinities.save(writer);
+	}
+
+	template <typename Reader>
+	inline void load(Reader& reader) {
+
+		_minAffinities.load(reader);
+	}
+
 private:
 
 	typename RegionGraphType::template EdgeMap<ValueType> _minAffinities;
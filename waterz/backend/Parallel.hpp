@@ -0,0 +1,141 @@
+#ifndef WATERZ_PARALLEL_H__
+#define WATERZ_PARALLEL_H__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <thread>
+#include <vector>
+
+/**
+ * The number of threads to use for parallel loops. Given by the environment
+ * variable WATERZ_NUM_THREADS, defaults to the number of cores.
+ */
+inline std::size_t numThreads() {
+
+	static const std::size_t threads = []() {
+
+		const char* value = std::getenv("WATERZ_NUM_THREADS");
+		if (value != NULL && std::atoi(value) > 0)
+			return std::size_t(std::atoi(value));
+
+		return std::max(std::size_t(1), std::size_t(std::thread::hardware_concurrency()));
+	}();
+
+	return threads;
+}
+
+/**
+ * Call f(begin, end) for consecutive ranges covering [0, n), in parallel.
+ * Ranges have at least minRange elements, such that small loops run in the
+ * calling thread only. Exceptions thrown by f are rethrown in the calling
+ * thread.
+ */
+template <typename F>
+void parallelFor(std::size_t n, const F& f, std::size_t minRange = 1 << 16) {
+
+	std::size_t threads = std::min(numThreads(), std::max(std::size_t(1), n/minRange));
+
+	if (threads <= 1) {
+
+		f(std::size_t(0), n);
+		return;
+	}
+
+	std::size_t rangeSize = (n + threads - 1)/threads;
+
+	std::vector<std::thread> workers;
+	std::vector<std::exception_ptr> errors(threads);
+
+	// the calling thread processes the first range
+	for (std::size_t t = 1; t < threads; t++) {
+
+		workers.emplace_back([&f, &errors, t, rangeSize, n]() {
+
+			try {
+
+				f(t*rangeSize, std::min(n, (t + 1)*rangeSize));
+
+			} catch (...) {
+
+				errors[t] = std::current_exception();
+			}
+		});
+	}
+
+	try {
+
+		f(std::size_t(0), std::min(n, rangeSize));
+
+	} catch (...) {
+
+		errors[0] = std::current_exception();
+	}
+
+	for (std::thread& worker : workers)
+		worker.join();
+
+	for (std::exception_ptr& error : errors)
+		if (error)
+			std::rethrow_exception(error);
+}
+
+/**
+ * Same as parallelFor(), but calls f(0, n) in the calling thread if parallel
+ * is false, e.g., for scoring functions that are not thread-safe.
+ */
+template <typename F>
+void parallelForIf(bool parallel, std::size_t n, const F& f, std::size_t minRange = 1 << 16) {
+
+	if (parallel)
+		parallelFor(n, f, minRange);
+	else
+		f(std::size_t(0), n);
+}
+
+/**
+ * Sort [begin, end) with the given comparison. Ranges of at least minRange
+ * elements are sorted in parallel and then merged pairwise.
+ */
+template <typename Iterator, typename Compare>
+void parallelSort(Iterator begin, Iterator end, const Compare& compare, std::size_t minRange = 1 << 16) {
+
+	std::size_t n = end - begin;
+	std::size_t chunks = std::min(numThreads(), std::max(std::size_t(1), n/minRange));
+
+	if (chunks <= 1) {
+
+		std::sort(begin, end, compare);
+		return;
+	}
+
+	std::size_t chunkSize = (n + chunks - 1)/chunks;
+
+	parallelFor(chunks, [begin, n, chunkSize, &compare](std::size_t first, std::size_t last) {
+
+		for (std::size_t c = first; c < last; c++)
+			std::sort(
+					begin + std::min(n, c*chunkSize),
+					begin + std::min(n, (c + 1)*chunkSize),
+					compare);
+	}, 1);
+
+	// merge neighboring sorted ranges, until there is only one left
+	for (std::size_t width = chunkSize; width < n; width *= 2) {
+
+		std::size_t pairs = (n + 2*width - 1)/(2*width);
+
+		parallelFor(pairs, [begin, n, width, &compare](std::size_t first, std::size_t last) {
+
+			for (std::size_t p = first; p < last; p++)
+				std::inplace_merge(
+						begin + p*2*width,
+						begin + std::min(n, p*2*width + width),
+						begin + std::min(n, (p + 1)*2*width),
+						compare);
+		}, 1);
+	}
+}
+
+#endif // WATERZ_PARALLEL_H__
@@ -0,0 +1,149 @@
+#ifndef WATERZ_PRE_MERGING_H__
+#define WATERZ_PRE_MERGING_H__
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "RegionGraph.hpp"
+#include "Parallel.hpp"
+#include "UnionFind.hpp"
+#include "Logging.hpp"
+
+/**
+ * Merge all edges with an initial score below the given threshold at once,
+ * before the region graph is used for iterative region merging.
+ *
+ * The regions connected by these edges are contracted with a union-find. Node
+ * and edge statistics are merged into the region with the lowest ID, and the
+ * region graph is rebuilt once over the contracted regions. Node IDs are
+ * kept, merged nodes lose all their edges.
+ *
+ * This is the same as merging these edges one by one, as long as merges do
+ * not increase their scores to the threshold or above. For scoring functions
+ * whose scores grow with region size, merges that would have been blocked
+ * in the iterative merging are performed anyway.
+ *
+ * @param regionGraph, scoringFunction, statisticsProvider [in, out]
+ *              The region graph to contract, the scoring function (called
+ *              concurrently, if its statistics provider is ThreadSafe), and
+ *              the provider of its statistics.
+ * @param threshold [in]
+ *              Edges with scores below the threshold are merged.
+ * @param roots [out]
+ *              The region each node got merged into.
+ * @return The number of merges.
+ */
+template <typename RegionGraphType, typename ScoringFunctionType, typename StatisticsProviderType, typename ScoreType>
+std::size_t
+preMerge(
+		RegionGraphType& regionGraph,
+		ScoringFunctionType& scoringFunction,
+		StatisticsProviderType& statisticsProvider,
+		ScoreType threshold,
+		std::vector<typename RegionGraphType::NodeIdType>& roots) {
+
+	typedef typename RegionGraphType::NodeIdType NodeIdType;
+	typedef typename RegionGraphType::EdgeIdType EdgeIdType;
+
+	std::size_t numNodes = regionGraph.numNodes();
+	std::size_t numEdges = regionGraph.numEdges();
+
+	// char instead of bool, such that threads can write concurrently
+	std::vector<char> below(numEdges);
+	parallelForIf(StatisticsProviderType::ThreadSafe, numEdges, [&](std::size_t begin, std::size_t end) {
+
+		for (EdgeIdType e = begin; e < end; e++)
+			below[e] = (scoringFunction(e) < threshold);
+	});
+
+	UnionFind<NodeIdType> regions(numNodes);
+	std::size_t merged = 0;
+
+	for (EdgeIdType e = 0; e < numEdges; e++) {
+
+		if (!below[e])
+			continue;
+
+		NodeIdType a = regions.find(regionGraph.edge(e).u);
+		NodeIdType b = regions.find(regionGraph.edge(e).v);
+
+		if (a != b) {
+
+			regions.merge(a, b);
+			merged++;
+		}
+	}
+
+	WATERZ_LOG << "pre-merged " << merged << " edges below " << threshold << std::endl;
+
+	// the lowest ID of each region is its root, which makes the result
+	// independent of the order of merges
+	roots.assign(numNodes, NodeIdType(0));
+	std::vector<NodeIdType> lowest(numNodes, NodeIdType(numNodes));
+	for (std::size_t n = 0; n < numNodes; n++) {
+
+		NodeIdType r = regions.find(n);
+		if (lowest[r] == numNodes)
+			lowest[r] = n;
+		roots[n] = lowest[r];
+	}
+
+	if (merged == 0)
+		return 0;
+
+	for (std::size_t n = 0; n < numNodes; n++)
+		if (roots[n] != n)
+			statisticsProvider.notifyNodeMerge(NodeIdType(n), roots[n]);
+
+	// sort the edges between different regions by their regions, the first
+	// edge of each pair of regions is kept and gets the statistics of the
+	// others
+	struct RegionEdge {
+
+		NodeIdType u;
+		NodeIdType v;
+		EdgeIdType e;
+
+		bool operator<(const RegionEdge& other) const {
+
+			return
+					u < other.u || (u == other.u && (
+					v < other.v || (v == other.v &&
+					e < other.e)));
+		}
+	};
+
+	std::vector<RegionEdge> regionEdges;
+	regionEdges.reserve(numEdges);
+	for (EdgeIdType e = 0; e < numEdges; e++) {
+
+		NodeIdType u = roots[regionGraph.edge(e).u];
+		NodeIdType v = roots[regionGraph.edge(e).v];
+
+		if (u != v)
+			regionEdges.push_back({std::min(u, v), std::max(u, v), e});
+	}
+
+	parallelSort(regionEdges.begin(), regionEdges.end(), std::less<RegionEdge>());
+
+	std::vector<EdgeIdType> kept;
+	for (std::size_t i = 0; i < regionEdges.size(); i++) {
+
+		const RegionEdge& edge = regionEdges[i];
+
+		if (i > 0 && edge.u == regionEdges[i - 1].u && edge.v == regionEdges[i - 1].v)
+			statisticsProvider.notifyEdgeMerge(edge.e, kept.back());
+		else
+			kept.push_back(edge.e);
+	}
+
+	std::sort(kept.begin(), kept.end());
+	regionGraph.contract(roots, kept);
+
+	WATERZ_LOG << "region graph has " << kept.size() << " edges after pre-merging" << std::endl;
+
+	return merged;
+}
+
+#endif // WATERZ_PRE_MERGING_H__
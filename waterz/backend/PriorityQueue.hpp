@@ -1,6 +1,11 @@
 #ifndef WATERZ_PRIORITY_QUEUE_H__
 #define WATERZ_PRIORITY_QUEUE_H__
 
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
 template <typename T, typename ScoreType>
 class PriorityQueue {
 
@@ -10,27 +15,83 @@ public:
 
 	void push(const T& element, ScoreType score) {
 
-		_queue.push({element, score});
+		_heap.push_back({element, score});
+		std::push_heap(_heap.begin(), _heap.end(), std::greater<Entry>());
+	}
+
+	/**
+	 * Add the elements 0, ..., n-1 with scores[i] at once. Builds the heap 
+	 * in linear time, instead of n log n for individual pushes.
+	 */
+	template <typename Scores>
+	void build(std::size_t n, const Scores& scores) {
+
+		_heap.reserve(_heap.size() + n);
+		for (std::size_t i = 0; i < n; i++)
+			_heap.push_back({T(i), scores[i]});
+
+		std::make_heap(_heap.begin(), _heap.end(), std::greater<Entry>());
 	}
 
 	const T& top() const {
 
-		return _queue.top().element;
+		return _heap.front().element;
 	}
 
 	void pop() {
 
-		_queue.pop();
+		std::pop_heap(_heap.begin(), _heap.end(), std::greater<Entry>());
+		_heap.pop_back();
 	}
 
 	bool empty() const {
 
-		return _queue.empty();
+		return _heap.empty();
 	}
 
 	size_t size() const {
 
-		return _queue.size();
+		return _heap.size();
+	}
+
+	/**
+	 * Write the heap as it is, such that a loaded queue pops elements with 
+	 * equal scores in the same order. Elements and scores are written as 
+	 * separate arrays, to not write the padding bytes of the heap entries.
+	 */
+	template <typename Writer>
+	void save(Writer& writer) const {
+
+		std::vector<T> elements;
+		std::vector<ScoreType> scores;
+		elements.reserve(_heap.size());
+		scores.reserve(_heap.size());
+
+		for (const Entry& entry : _heap) {
+
+			elements.push_back(entry.element);
+			scores.push_back(entry.score);
+		}
+
+		writer.write(elements);
+		writer.write(scores);
+	}
+
+	template <typename Reader>
+	void load(Reader& reader) {
+
+		std::vector<T> elements;
+		std::vector<ScoreType> scores;
+		reader.read(elements);
+		reader.read(scores);
+
+		if (elements.size() != scores.size())
+			throw std::runtime_error("corrupt priority queue state");
+
+		_heap.clear();
+		_heap.reserve(elements.size());
+		for (std::size_t i = 0; i < elements.size(); i++)
+			_heap.push_back({elements[i], scores[i]});
 	}
 
 private:
@@ -45,9 +106,9 @@ private:
 		}
 	};
 
-	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> _queue;
+	// a min-heap, managed like in std::priority_queue
+	std::vector<Entry> _heap;
 };
 
 
 #endif // WATERZ_PRIORITY_QUEUE_H__
-
@@ -14,6 +14,10 @@ public:
 
 	typedef float ValueType;
 
+	// rand() is not thread-safe, and the sequence of numbers depends on the 
+	// order of calls
+	static const bool ThreadSafe = false;
+
 	template <typename RegionGraphType>
 	RandomNumberProvider(RegionGraphType&) {}
 
@@ -5,6 +5,9 @@
 #include <vector>
 #include <limits>
 #include <cassert>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
 
 template <typename ID>
 struct RegionGraphEdge {
@@ -75,6 +78,21 @@ public:
 	inline typename Container::const_reference operator[](ID i) const { return _values[i]; }
 	inline typename Container::reference operator[](ID i) { return _values[i]; }
 
+	template <typename Writer>
+	void save(Writer& writer) const {
+
+		writer.write(_values);
+	}
+
+	template <typename Reader>
+	void load(Reader& reader) {
+
+		reader.read(_values);
+
+		if (_values.size() != this->getRegionGraph().numNodes())
+			throw std::runtime_error("node map does not match region graph");
+	}
+
 private:
 
 	void onNewNode(ID id) {
@@ -115,6 +133,8 @@ private:
 
 	virtual void onNewEdge(std::size_t id) = 0;
 
+	virtual void onContract(const std::vector<std::size_t>& kept) = 0;
+
 	RegionGraphType& _regionGraph;
 };
 
@@ -134,6 +154,21 @@ public:
 	inline typename Container::const_reference operator[](std::size_t i) const { return _values[i]; }
 	inline typename Container::reference operator[](std::size_t i) { return _values[i]; }
 
+	template <typename Writer>
+	void save(Writer& writer) const {
+
+		writer.write(_values);
+	}
+
+	template <typename Reader>
+	void load(Reader& reader) {
+
+		reader.read(_values);
+
+		if (_values.size() != this->getRegionGraph().numEdges())
+			throw std::runtime_error("edge map does not match region graph");
+	}
+
 private:
 
 	void onNewEdge(std::size_t id) {
@@ -141,6 +176,16 @@ private:
 		_values.push_back(T());
 	}
 
+	void onContract(const std::vector<std::size_t>& kept) {
+
+		// kept is sorted, values are only moved to lower indices
+		for (std::size_t i = 0; i < kept.size(); i++)
+			if (kept[i] != i)
+				_values[i] = std::move(_values[kept[i]]);
+
+		_values.resize(kept.size());
+	}
+
 	Container _values;
 };
 
@@ -196,6 +241,88 @@ public:
 		return id;
 	}
 
+	/**
+	 * Add many edges at once, given as pairs (u, v) in a contiguous array. 
+	 * Edges get consecutive IDs in the given order. Pairs have to be unique, 
+	 * with u != v. Throws std::invalid_argument for invalid node IDs.
+	 */
+	void addEdges(const NodeIdType* uv, std::size_t numEdges) {
+
+		EdgeIdType first = _edges.size();
+
+		// count incident edges first, to allocate each list only once
+		std::vector<std::size_t> degrees(_numNodes, 0);
+		for (std::size_t i = 0; i < numEdges; i++) {
+
+			NodeIdType u = uv[2*i];
+			NodeIdType v = uv[2*i + 1];
+
+			if (u >= _numNodes || v >= _numNodes || u == v)
+				throw std::invalid_argument("invalid edge in region graph");
+
+			degrees[u]++;
+			degrees[v]++;
+		}
+
+		for (std::size_t n = 0; n < _numNodes; n++)
+			_incEdges[n].reserve(_incEdges[n].size() + degrees[n]);
+		_edges.reserve(first + numEdges);
+
+		for (std::size_t i = 0; i < numEdges; i++) {
+
+			NodeIdType u = uv[2*i];
+			NodeIdType v = uv[2*i + 1];
+			EdgeIdType id = first + i;
+
+			_edges.push_back(EdgeType(std::min(u, v), std::max(u, v)));
+			_incEdges[u].push_back(id);
+			_incEdges[v].push_back(id);
+		}
+
+		for (RegionGraphEdgeMapBase<ID>* map : _edgeMaps)
+			for (EdgeIdType id = first; id < _edges.size(); id++)
+				map->onNewEdge(id);
+	}
+
+	/**
+	 * Replace each node n by roots[n], and keep only the given edges. Kept 
+	 * edges get the IDs 0 to kept.size()-1 in the given order, edge maps are 
+	 * compacted accordingly. kept has to be sorted, and must not contain two 
+	 * edges that connect the same nodes after the replacement, or an edge 
+	 * within a node.
+	 */
+	void contract(const std::vector<NodeIdType>& roots, const std::vector<EdgeIdType>& kept) {
+
+		std::vector<EdgeType> edges(kept.size());
+		std::vector<std::size_t> degrees(_numNodes, 0);
+
+		for (std::size_t i = 0; i < kept.size(); i++) {
+
+			NodeIdType u = roots[_edges[kept[i]].u];
+			NodeIdType v = roots[_edges[kept[i]].v];
+			assert(u != v);
+
+			edges[i] = EdgeType(std::min(u, v), std::max(u, v));
+			degrees[u]++;
+			degrees[v]++;
+		}
+
+		_edges.swap(edges);
+
+		std::vector<std::vector<EdgeIdType>> incEdges(_numNodes);
+		for (std::size_t n = 0; n < _numNodes; n++)
+			incEdges[n].reserve(degrees[n]);
+		for (EdgeIdType e = 0; e < _edges.size(); e++) {
+
+			incEdges[_edges[e].u].push_back(e);
+			incEdges[_edges[e].v].push_back(e);
+		}
+		_incEdges.swap(incEdges);
+
+		for (RegionGraphEdgeMapBase<ID>* map : _edgeMaps)
+			map->onContract(kept);
+	}
+
 	void removeEdge(EdgeIdType e) {
 
 		removeIncEdge(_edges[e].u, e);
@@ -292,6 +419,46 @@ public:
 		return NoEdge;
 	}
 
+	/**
+	 * Write the nodes and edges of this region graph, without node and edge 
+	 * maps.
+	 */
+	template <typename Writer>
+	void save(Writer& writer) const {
+
+		writer.write(static_cast<uint64_t>(_numNodes));
+		writer.write(_edges);
+		writer.write(_incEdges);
+	}
+
+	/**
+	 * Replace this region graph with one written by save(). Has to be called 
+	 * before node or edge maps are created for this region graph.
+	 */
+	template <typename Reader>
+	void load(Reader& reader) {
+
+		if (!_nodeMaps.empty() || !_edgeMaps.empty())
+			throw std::logic_error("region graph can not be loaded after creating node or edge maps");
+
+		uint64_t numNodes;
+		reader.read(numNodes);
+		reader.read(_edges);
+		reader.read(_incEdges);
+
+		_numNodes = numNodes;
+
+		if (_incEdges.size() != _numNodes)
+			throw std::runtime_error("corrupt region graph");
+		for (const EdgeType& edge : _edges)
+			if (edge.u >= _numNodes || edge.v >= _numNodes)
+				throw std::runtime_error("corrupt region graph");
+		for (const auto& incEdges : _incEdges)
+			for (EdgeIdType e : incEdges)
+				if (e >= _edges.size())
+					throw std::runtime_error("corrupt region graph");
+	}
+
 private:
 
 	friend RegionGraphNodeMapBase<ID>;
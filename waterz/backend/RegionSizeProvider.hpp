@@ -16,6 +16,13 @@ public:
 		_regionSizes[n]++;
 	}
 
+	template <typename SizeType>
+	inline void initNodeSizes(const SizeType* sizes, std::size_t numNodes) {
+
+		for (std::size_t n = 0; n < numNodes; n++)
+			_regionSizes[n] = sizes[n];
+	}
+
 	inline bool notifyNodeMerge(NodeIdType from, NodeIdType to) {
 
 		_regionSizes[to] += _regionSizes[from];
@@ -29,6 +36,27 @@ public:
 		return _regionSizes[n];
 	}
 
+	template <typename Seeds>
+	inline void seed(const Seeds& seeds) {
+
+		const uint64_t* sizes = Seeds::require(seeds.regionSizes, "region sizes");
+
+		for (std::size_t n = 0; n < seeds.numNodes; n++)
+			_regionSizes[n] = sizes[n];
+	}
+
+	template <typename Writer>
+	inline void save(Writer& writer) const {
+
+		_regionSizes.save(writer);
+	}
+
+	template <typename Reader>
+	inline void load(Reader& reader) {
+
+		_regionSizes.load(reader);
+	}
+
 private:
 
 	typename RegionGraphType::template NodeMap<ValueType> _regionSizes;
@@ -0,0 +1,75 @@
+#ifndef WATERZ_RING_BUFFER_H__
+#define WATERZ_RING_BUFFER_H__
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+/**
+ * A fixed-size buffer that keeps the last N elements pushed into it. Older 
+ * elements are overwritten.
+ */
+template <typename T>
+class RingBuffer {
+
+public:
+
+	RingBuffer(std::size_t capacity) :
+		_elements(capacity),
+		_next(0),
+		_pushed(0) {}
+
+	void push(const T& element) {
+
+		if (_elements.empty())
+			return;
+
+		_elements[_next] = element;
+		_next++;
+		if (_next == _elements.size())
+			_next = 0;
+		_pushed++;
+	}
+
+	/**
+	 * The number of elements in the buffer.
+	 */
+	std::size_t size() const {
+
+		return std::min(_pushed, _elements.size());
+	}
+
+	/**
+	 * The number of elements that got overwritten.
+	 */
+	std::size_t dropped() const {
+
+		return _pushed - size();
+	}
+
+	/**
+	 * Get the elements in the order they were pushed, and clear the buffer.
+	 */
+	std::vector<T> drain() {
+
+		std::vector<T> elements;
+		elements.reserve(size());
+
+		std::size_t first = (_pushed > _elements.size() ? _next : 0);
+		for (std::size_t i = 0; i < size(); i++)
+			elements.push_back(_elements[(first + i)%_elements.size()]);
+
+		_next = 0;
+		_pushed = 0;
+
+		return elements;
+	}
+
+private:
+
+	std::vector<T> _elements;
+	std::size_t _next;
+	std::size_t _pushed;
+};
+
+#endif // WATERZ_RING_BUFFER_H__
@@ -0,0 +1,826 @@
+#ifndef WATERZ_SCORING_EXPRESSION_H__
+#define WATERZ_SCORING_EXPRESSION_H__
+
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "StatisticsProvider.hpp"
+#include "Histogram.hpp"
+#include "discretize.hpp"
+
+/**
+ * A scoring function given as a string, e.g.,
+ *
+ *   1 - quantile75(aff) * log(contact_area)
+ *
+ * that is parsed at runtime into a flat bytecode for a small stack machine.
+ *
+ * Statistics:
+ *
+ *   mean(aff), max(aff), min(aff)   mean, max, min affinity of an edge
+ *   quantileQ(aff)                  Q-th quantile (0..100) of the affinities,
+ *                                   from a 256-bin histogram
+ *   contact_area                    number of affinities of an edge
+ *   min_size, max_size              min and max size of the incident regions
+ *
+ * Operators and functions:
+ *
+ *   + - * / ^, unary -, log, exp, sqrt, abs, min(x, y), max(x, y), step(x, y)
+ *
+ * Division and step() behave like the Divide and Step operators in
+ * Operators.hpp. Only the statistics used in the expression are collected.
+ */
+class ScoringExpression {
+
+public:
+
+	enum Statistic {
+
+		MeanAffinity     = 1 << 0,
+		MaxAffinity      = 1 << 1,
+		MinAffinity      = 1 << 2,
+		QuantileAffinity = 1 << 3,
+		ContactArea      = 1 << 4,
+		MinSize          = 1 << 5,
+		MaxSize          = 1 << 6
+	};
+
+	enum OpCode {
+
+		Constant,
+		Load,
+		Add,
+		Subtract,
+		Multiply,
+		Divide,
+		Power,
+		Negate,
+		Log,
+		Exp,
+		Sqrt,
+		Abs,
+		Min,
+		Max,
+		Step
+	};
+
+	struct Instruction {
+
+		OpCode op;
+
+		// value of constants
+		double constant;
+
+		// statistic to load, and its parameter (the quantile)
+		Statistic statistic;
+		int parameter;
+	};
+
+	static const int MaxStackSize = 64;
+
+	ScoringExpression() : _statistics(0) {}
+
+	/**
+	 * Parse an expression. Throws std::invalid_argument on syntax errors.
+	 */
+	explicit ScoringExpression(const std::string& expression) :
+		_expression(expression),
+		_statistics(0),
+		_pos(0) {
+
+		parseExpression();
+		skipWhitespace();
+
+		if (_pos != _expression.size())
+			error("unexpected '" + _expression.substr(_pos) + "'");
+
+		checkStackSize();
+	}
+
+	const std::string& string() const { return _expression; }
+
+	/**
+	 * Bitmask of the statistics used in this expression.
+	 */
+	int statistics() const { return _statistics; }
+
+	bool uses(Statistic statistic) const { return _statistics & statistic; }
+
+	const std::vector<Instruction>& instructions() const { return _instructions; }
+
+	/**
+	 * Evaluate the expression. 'load' is called with an Instruction and
+	 * returns the value of the requested statistic.
+	 */
+	template <typename T, typename LoadFunction>
+	inline T evaluate(LoadFunction load) const {
+
+		T stack[MaxStackSize];
+		int top = -1;
+
+		for (const Instruction& instruction : _instructions) {
+
+			switch (instruction.op) {
+
+				case Constant:
+					stack[++top] = instruction.constant;
+					break;
+				case Load:
+					stack[++top] = load(instruction);
+					break;
+				case Add:
+					top--;
+					stack[top] = stack[top] + stack[top+1];
+					break;
+				case Subtract:
+					top--;
+					stack[top] = stack[top] - stack[top+1];
+					break;
+				case Multiply:
+					top--;
+					stack[top] = stack[top]*stack[top+1];
+					break;
+				case Divide:
+					top--;
+					stack[top] = saveDivide(stack[top], stack[top+1]);
+					break;
+				case Power:
+					top--;
+					stack[top] = std::pow(stack[top], stack[top+1]);
+					break;
+				case Negate:
+					stack[top] = -stack[top];
+					break;
+				case Log:
+					stack[top] = std::log(stack[top]);
+					break;
+				case Exp:
+					stack[top] = std::exp(stack[top]);
+					break;
+				case Sqrt:
+					stack[top] = std::sqrt(stack[top]);
+					break;
+				case Abs:
+					stack[top] = std::abs(stack[top]);
+					break;
+				case Min:
+					top--;
+					stack[top] = std::min(stack[top], stack[top+1]);
+					break;
+				case Max:
+					top--;
+					stack[top] = std::max(stack[top], stack[top+1]);
+					break;
+				case Step:
+					top--;
+					stack[top] = (stack[top] < stack[top+1] ? 0 : 1);
+					break;
+			}
+		}
+
+		return stack[0];
+	}
+
+private:
+
+	template <typename T>
+	static inline T saveDivide(T a, T b) {
+
+		if (std::abs(b) <= std::numeric_limits<T>::min()) {
+
+			if (std::signbit(a*b))
+				return std::numeric_limits<T>::lowest();
+			else
+				return std::numeric_limits<T>::max();
+		}
+
+		return a/b;
+	}
+
+	// expression := term (('+' | '-') term)*
+	void parseExpression() {
+
+		parseTerm();
+
+		while (true) {
+
+			if (accept('+')) {
+
+				parseTerm();
+				emit(Add);
+
+			} else if (accept('-')) {
+
+				parseTerm();
+				emit(Subtract);
+
+			} else {
+
+				break;
+			}
+		}
+	}
+
+	// term := unary (('*' | '/') unary)*
+	void parseTerm() {
+
+		parseUnary();
+
+		while (true) {
+
+			if (accept('*')) {
+
+				parseUnary();
+				emit(Multiply);
+
+			} else if (accept('/')) {
+
+				parseUnary();
+				emit(Divide);
+
+			} else {
+
+				break;
+			}
+		}
+	}
+
+	// unary := '-' unary | power
+	void parseUnary() {
+
+		if (accept('-')) {
+
+			parseUnary();
+			emit(Negate);
+
+		} else {
+
+			parsePower();
+		}
+	}
+
+	// power := primary ('^' unary)?
+	void parsePower() {
+
+		parsePrimary();
+
+		if (accept('^')) {
+
+			parseUnary();
+			emit(Power);
+		}
+	}
+
+	// primary := number | name | name '(' arguments ')' | '(' expression ')'
+	void parsePrimary() {
+
+		skipWhitespace();
+
+		if (accept('(')) {
+
+			parseExpression();
+			expect(')');
+			return;
+		}
+
+		if (_pos < _expression.size() &&
+			(std::isdigit(_expression[_pos]) || _expression[_pos] == '.')) {
+
+			const char* begin = _expression.c_str() + _pos;
+			char* end;
+			double value = std::strtod(begin, &end);
+			_pos += end - begin;
+
+			Instruction instruction = { Constant, value, MeanAffinity, 0 };
+			_instructions.push_back(instruction);
+			return;
+		}
+
+		std::string name = parseName();
+		if (name.empty())
+			error("expected a number, name, or '('");
+
+		if (name == "contact_area") {
+
+			emitLoad(ContactArea);
+
+		} else if (name == "min_size") {
+
+			emitLoad(MinSize);
+
+		} else if (name == "max_size") {
+
+			emitLoad(MaxSize);
+
+		} else if (accept('(')) {
+
+			parseFunction(name);
+
+		} else {
+
+			error("unknown name '" + name + "'");
+		}
+	}
+
+	void parseFunction(const std::string& name) {
+
+		// statistics of the affinities of an edge
+		skipWhitespace();
+		std::size_t pos = _pos;
+		if (parseName() == "aff") {
+
+			expect(')');
+
+			if (name == "mean")
+				emitLoad(MeanAffinity);
+			else if (name == "max")
+				emitLoad(MaxAffinity);
+			else if (name == "min")
+				emitLoad(MinAffinity);
+			else if (name.compare(0, 8, "quantile") == 0 && name.size() > 8)
+				emitLoad(QuantileAffinity, parseQuantile(name.substr(8)));
+			else
+				error("unknown statistic '" + name + "(aff)'");
+
+			return;
+		}
+		_pos = pos;
+
+		parseExpression();
+
+		if (name == "log" || name == "exp" || name == "sqrt" || name == "abs") {
+
+			expect(')');
+			emit(name == "log" ? Log : name == "exp" ? Exp : name == "sqrt" ? Sqrt : Abs);
+
+		} else if (name == "min" || name == "max" || name == "step") {
+
+			expect(',');
+			parseExpression();
+			expect(')');
+			emit(name == "min" ? Min : name == "max" ? Max : Step);
+
+		} else {
+
+			error("unknown function '" + name + "'");
+		}
+	}
+
+	int parseQuantile(const std::string& digits) {
+
+		for (char c : digits)
+			if (!std::isdigit(c))
+				error("invalid quantile '" + digits + "'");
+
+		int quantile = std::atoi(digits.c_str());
+		if (quantile > 100)
+			error("quantile has to be in [0,100]");
+
+		return quantile;
+	}
+
+	std::string parseName() {
+
+		skipWhitespace();
+
+		std::size_t begin = _pos;
+		while (_pos < _expression.size() &&
+				(std::isalnum(_expression[_pos]) || _expression[_pos] == '_'))
+			_pos++;
+
+		return _expression.substr(begin, _pos - begin);
+	}
+
+	void emit(OpCode op) {
+
+		Instruction instruction = { op, 0, MeanAffinity, 0 };
+		_instructions.push_back(instruction);
+	}
+
+	void emitLoad(Statistic statistic, int parameter = 0) {
+
+		Instruction instruction = { Load, 0, statistic, parameter };
+		_instructions.push_back(instruction);
+		_statistics |= statistic;
+	}
+
+	bool accept(char c) {
+
+		skipWhitespace();
+
+		if (_pos < _expression.size() && _expression[_pos] == c) {
+
+			_pos++;
+			return true;
+		}
+
+		return false;
+	}
+
+	void expect(char c) {
+
+		if (!accept(c))
+			error(std::string("expected '") + c + "'");
+	}
+
+	void skipWhitespace() {
+
+		while (_pos < _expression.size() && std::isspace(_expression[_pos]))
+			_pos++;
+	}
+
+	void checkStackSize() {
+
+		int size = 0;
+		for (const Instruction& instruction : _instructions) {
+
+			switch (instruction.op) {
+
+				case Constant:
+				case Load:
+					size++;
+					break;
+				case Negate:
+				case Log:
+				case Exp:
+				case Sqrt:
+				case Abs:
+					break;
+				default:
+					size--;
+			}
+
+			if (size > MaxStackSize)
+				error("expression too complex");
+		}
+	}
+
+	void error(const std::string& message) {
+
+		throw std::invalid_argument(
+				"invalid scoring expression '" + _expression + "' at position " +
+				std::to_string(_pos) + ": " + message);
+	}
+
+	std::string _expression;
+	std::vector<Instruction> _instructions;
+	int _statistics;
+
+	// parser position
+	std::size_t _pos;
+};
+
+/**
+ * A statistics provider that collects only the statistics needed by a
+ * ScoringExpression. Has to be configured before edges are added.
+ */
+template <typename RegionGraphType, typename Precision>
+class ExpressionStatisticsProvider : public StatisticsProvider {
+
+public:
+
+	typedef typename RegionGraphType::NodeIdType NodeIdType;
+	typedef typename RegionGraphType::EdgeIdType EdgeIdType;
+
+	static const int Bins = 256;
+
+	ExpressionStatisticsProvider(RegionGraphType& regionGraph) :
+		_regionGraph(regionGraph) {}
+
+	/**
+	 * Set the expression to collect statistics for.
+	 */
+	void configure(const ScoringExpression& expression) {
+
+		_expression = expression;
+
+		if (_expression.uses(ScoringExpression::MeanAffinity) ||
+			_expression.uses(ScoringExpression::ContactArea))
+			_numValues.reset(new EdgeMap<std::size_t>(_regionGraph));
+		if (_expression.uses(ScoringExpression::MeanAffinity))
+			_meanAffinities.reset(new EdgeMap<Precision>(_regionGraph));
+		if (_expression.uses(ScoringExpression::MaxAffinity))
+			_maxAffinities.reset(new EdgeMap<Precision>(_regionGraph));
+		if (_expression.uses(ScoringExpression::MinAffinity))
+			_minAffinities.reset(new EdgeMap<Precision>(_regionGraph));
+		if (_expression.uses(ScoringExpression::QuantileAffinity))
+			_histograms.reset(new EdgeMap<Histogram<Bins>>(_regionGraph));
+		if (_expression.uses(ScoringExpression::MinSize) ||
+			_expression.uses(ScoringExpression::MaxSize))
+			_regionSizes.reset(new NodeMap<std::size_t>(_regionGraph));
+	}
+
+	const ScoringExpression& expression() const { return _expression; }
+
+	inline void notifyNewEdge(EdgeIdType e) {
+
+		if (_numValues)
+			(*_numValues)[e] = 0;
+		if (_meanAffinities)
+			(*_meanAffinities)[e] = 0;
+		if (_maxAffinities)
+			(*_maxAffinities)[e] = 0;
+		if (_minAffinities)
+			(*_minAffinities)[e] = std::numeric_limits<Precision>::max();
+	}
+
+	inline void addAffinity(EdgeIdType e, Precision affinity) {
+
+		if (_meanAffinities) {
+
+			std::size_t n = (*_numValues)[e];
+			Precision mean = (*_meanAffinities)[e];
+			(*_meanAffinities)[e] = (affinity + mean*n)/(n+1);
+		}
+		if (_numValues)
+			(*_numValues)[e]++;
+		if (_maxAffinities)
+			(*_maxAffinities)[e] = std::max((*_maxAffinities)[e], affinity);
+		if (_minAffinities)
+			(*_minAffinities)[e] = std::min((*_minAffinities)[e], affinity);
+		if (_histograms) {
+
+			// same as HistogramQuantileProvider with InitWithMax
+			Histogram<Bins>& histogram = (*_histograms)[e];
+			int bin = discretize<int>(affinity, Bins);
+
+			if (histogram.lowestBin() != Bins) {
+
+				if (bin > histogram.lowestBin())
+					histogram.clear();
+				else
+					return;
+			}
+
+			histogram.inc(bin);
+		}
+	}
+
+	inline void addVoxel(NodeIdType n, std::size_t x, std::size_t y, std::size_t z) {
+
+		if (_regionSizes)
+			(*_regionSizes)[n]++;
+	}
+
+	template <typename SizeType>
+	inline void initNodeSizes(const SizeType* sizes, std::size_t numNodes) {
+
+		if (_regionSizes)
+			for (std::size_t n = 0; n < numNodes; n++)
+				(*_regionSizes)[n] = sizes[n];
+	}
+
+	inline bool notifyNodeMerge(NodeIdType from, NodeIdType to) {
+
+		if (!_regionSizes)
+			return false;
+
+		(*_regionSizes)[to] += (*_regionSizes)[from];
+		(*_regionSizes)[from] = 0;
+
+		return true;
+	}
+
+	inline bool notifyEdgeMerge(EdgeIdType from, EdgeIdType to) {
+
+		bool changed = false;
+
+		if (_meanAffinities) {
+
+			std::size_t fromN = (*_numValues)[from];
+			std::size_t toN = (*_numValues)[to];
+			Precision fromMean = (*_meanAffinities)[from];
+			Precision toMean = (*_meanAffinities)[to];
+
+			(*_meanAffinities)[to] = (fromMean*fromN + toMean*toN)/(fromN + toN);
+		}
+		if (_numValues) {
+
+			(*_numValues)[to] += (*_numValues)[from];
+			changed = true;
+		}
+		if (_maxAffinities && (*_maxAffinities)[from] > (*_maxAffinities)[to]) {
+
+			(*_maxAffinities)[to] = (*_maxAffinities)[from];
+			changed = true;
+		}
+		if (_minAffinities && (*_minAffinities)[from] < (*_minAffinities)[to]) {
+
+			(*_minAffinities)[to] = (*_minAffinities)[from];
+			changed = true;
+		}
+		if (_histograms) {
+
+			(*_histograms)[to] += (*_histograms)[from];
+			(*_histograms)[from].clear();
+			changed = true;
+		}
+
+		return changed;
+	}
+
+	/**
+	 * Get the value of a statistic for an edge.
+	 */
+	inline Precision get(EdgeIdType e, const ScoringExpression::Instruction& instruction) const {
+
+		switch (instruction.statistic) {
+
+			case ScoringExpression::MeanAffinity:
+				return (*_meanAffinities)[e];
+			case ScoringExpression::MaxAffinity:
+				return (*_maxAffinities)[e];
+			case ScoringExpression::MinAffinity:
+				return (*_minAffinities)[e];
+			case ScoringExpression::QuantileAffinity:
+				return quantile(e, instruction.parameter);
+			case ScoringExpression::ContactArea:
+				return (*_numValues)[e];
+			case ScoringExpression::MinSize:
+				return std::min(
+						(*_regionSizes)[_regionGraph.edge(e).u],
+						(*_regionSizes)[_regionGraph.edge(e).v]);
+			case ScoringExpression::MaxSize:
+				return std::max(
+						(*_regionSizes)[_regionGraph.edge(e).u],
+						(*_regionSizes)[_regionGraph.edge(e).v]);
+		}
+
+		return 0;
+	}
+
+	/**
+	 * Initialize the statistics used by the expression from precomputed 
+	 * values. Has to be configured before.
+	 */
+	template <typename Seeds>
+	void seed(const Seeds& seeds) {
+
+		if (_numValues) {
+
+			const uint64_t* counts = Seeds::require(seeds.contactAreas, "contact areas");
+			for (std::size_t e = 0; e < seeds.numEdges; e++)
+				(*_numValues)[e] = counts[e];
+		}
+		if (_meanAffinities) {
+
+			const Precision* means = Seeds::require(seeds.meanAffinities, "mean affinities");
+			for (std::size_t e = 0; e < seeds.numEdges; e++)
+				(*_meanAffinities)[e] = means[e];
+		}
+		if (_maxAffinities) {
+
+			const Precision* maxima = Seeds::require(seeds.maxAffinities, "max affinities");
+			for (std::size_t e = 0; e < seeds.numEdges; e++)
+				(*_maxAffinities)[e] = maxima[e];
+		}
+		if (_minAffinities) {
+
+			const Precision* minima = Seeds::require(seeds.minAffinities, "min affinities");
+			for (std::size_t e = 0; e < seeds.numEdges; e++)
+				(*_minAffinities)[e] = minima[e];
+		}
+		if (_histograms) {
+
+			const uint32_t* histograms = Seeds::require(seeds.histograms, "histograms");
+			if (seeds.histogramBins != Bins)
+				throw std::invalid_argument(
+						"the statistics provider requires histograms with " +
+						std::to_string(Bins) + " bins");
+			for (std::size_t e = 0; e < seeds.numEdges; e++)
+				(*_histograms)[e].assign(histograms + e*Bins);
+		}
+		if (_regionSizes) {
+
+			const uint64_t* sizes = Seeds::require(seeds.regionSizes, "region sizes");
+			for (std::size_t n = 0; n < seeds.numNodes; n++)
+				(*_regionSizes)[n] = sizes[n];
+		}
+	}
+
+	/**
+	 * Write the expression and the statistics collected for it.
+	 */
+	template <typename Writer>
+	void save(Writer& writer) const {
+
+		writer.write(_expression.string());
+
+		if (_numValues)
+			_numValues->save(writer);
+		if (_meanAffinities)
+			_meanAffinities->save(writer);
+		if (_maxAffinities)
+			_maxAffinities->save(writer);
+		if (_minAffinities)
+			_minAffinities->save(writer);
+		if (_histograms)
+			_histograms->save(writer);
+		if (_regionSizes)
+			_regionSizes->save(writer);
+	}
+
+	/**
+	 * Read the expression and the statistics written by save(). Configures 
+	 * this provider for the expression.
+	 */
+	template <typename Reader>
+	void load(Reader& reader) {
+
+		std::string expression;
+		reader.read(expression);
+
+		configure(ScoringExpression(expression));
+
+		if (_numValues)
+			_numValues->load(reader);
+		if (_meanAffinities)
+			_meanAffinities->load(reader);
+		if (_maxAffinities)
+			_maxAffinities->load(reader);
+		if (_minAffinities)
+			_minAffinities->load(reader);
+		if (_histograms)
+			_histograms->load(reader);
+		if (_regionSizes)
+			_regionSizes->load(reader);
+	}
+
+private:
+
+	template <typename T>
+	using EdgeMap = typename RegionGraphType::template EdgeMap<T>;
+
+	template <typename T>
+	using NodeMap = typename RegionGraphType::template NodeMap<T>;
+
+	// same as HistogramQuantileProvider
+	inline Precision quantile(EdgeIdType e, int q) const {
+
+		const Histogram<Bins>& histogram = (*_histograms)[e];
+
+		// pivot element, 1-based index
+		int pivot = q*histogram.sum()/100 + 1;
+
+		int sum = 0;
+		int bin = 0;
+		for (bin = 0; bin < Bins; bin++) {
+
+			sum += histogram[bin];
+
+			if (sum >= pivot)
+				break;
+		}
+
+		return undiscretize<Precision>(bin, Bins);
+	}
+
+	RegionGraphType& _regionGraph;
+
+	ScoringExpression _expression;
+
+	std::unique_ptr<EdgeMap<std::size_t>>     _numValues;
+	std::unique_ptr<EdgeMap<Precision>>       _meanAffinities;
+	std::unique_ptr<EdgeMap<Precision>>       _maxAffinities;
+	std::unique_ptr<EdgeMap<Precision>>       _minAffinities;
+	std::unique_ptr<EdgeMap<Histogram<Bins>>> _histograms;
+	std::unique_ptr<NodeMap<std::size_t>>     _regionSizes;
+};
+
+/**
+ * Scores edges with the ScoringExpression of an ExpressionStatisticsProvider.
+ */
+template <typename RegionGraphType, typename Precision>
+class ExpressionScore {
+
+public:
+
+	typedef ExpressionStatisticsProvider<RegionGraphType, Precision> StatisticsProviderType;
+	typedef typename RegionGraphType::EdgeIdType EdgeIdType;
+	typedef Precision ScoreType;
+
+	ExpressionScore(
+			RegionGraphType&,
+			const StatisticsProviderType& provider) :
+		_provider(provider) {}
+
+	inline ScoreType operator()(EdgeIdType e) {
+
+		return _provider.expression().template evaluate<ScoreType>(
+				[this, e](const ScoringExpression::Instruction& instruction) {
+					return _provider.get(e, instruction);
+				});
+	}
+
+private:
+
+	const StatisticsProviderType& _provider;
+};
+
+#endif // WATERZ_SCORING_EXPRESSION_H__
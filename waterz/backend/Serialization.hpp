@@ -0,0 +1,244 @@
+#ifndef WATERZ_SERIALIZATION_H__
+#define WATERZ_SERIALIZATION_H__
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Writes values in a compact binary format to a stream.
+ *
+ * Scalars are stored as they are in memory, arrays as their length followed by
+ * the raw elements. Every value is padded to a multiple of 8 bytes, such that
+ * arrays start at aligned offsets and a file can be mapped into memory
+ * directly. Files are only portable between machines with the same endianness
+ * and type sizes.
+ */
+class BinaryWriter {
+
+public:
+
+	BinaryWriter(std::ostream& out) :
+		_out(out),
+		_offset(0) {}
+
+	template <typename T>
+	void write(const T& value) {
+
+		static_assert(
+				std::is_trivially_copyable<T>::value,
+				"only trivially copyable types can be written directly");
+
+		writeBytes(&value, sizeof(T));
+		pad();
+	}
+
+	template <typename T>
+	void write(const std::vector<T>& values) {
+
+		writeArray(values.data(), values.size());
+	}
+
+	/**
+	 * Write an array the same way as a vector, without copying it into one.
+	 */
+	template <typename T>
+	void writeArray(const T* data, std::size_t size) {
+
+		static_assert(
+				std::is_trivially_copyable<T>::value,
+				"only arrays of trivially copyable types can be written directly");
+
+		write(static_cast<uint64_t>(size));
+		writeBytes(data, size*sizeof(T));
+		pad();
+	}
+
+	void write(const std::vector<bool>& values) {
+
+		write(std::vector<uint8_t>(values.begin(), values.end()));
+	}
+
+	/**
+	 * Nested vectors are stored as offsets into a single array of all values.
+	 */
+	template <typename T>
+	void write(const std::vector<std::vector<T>>& values) {
+
+		std::vector<uint64_t> offsets(values.size() + 1, 0);
+		for (std::size_t i = 0; i < values.size(); i++)
+			offsets[i + 1] = offsets[i] + values[i].size();
+
+		std::vector<T> all;
+		all.reserve(offsets.back());
+		for (const auto& v : values)
+			all.insert(all.end(), v.begin(), v.end());
+
+		write(offsets);
+		write(all);
+	}
+
+	void write(const std::string& value) {
+
+		write(std::vector<char>(value.begin(), value.end()));
+	}
+
+private:
+
+	void writeBytes(const void* data, std::size_t size) {
+
+		_out.write(static_cast<const char*>(data), size);
+		_offset += size;
+
+		if (!_out)
+			throw std::runtime_error("failed to write to stream");
+	}
+
+	void pad() {
+
+		static const char zeros[8] = {0};
+
+		if (_offset % 8 != 0)
+			writeBytes(zeros, 8 - _offset % 8);
+	}
+
+	std::ostream& _out;
+	std::size_t _offset;
+};
+
+/**
+ * Reads values written by a BinaryWriter. Throws std::runtime_error on
+ * truncated or corrupt streams.
+ */
+class BinaryReader {
+
+public:
+
+	BinaryReader(std::istream& in) :
+		_in(in),
+		_offset(0) {}
+
+	template <typename T>
+	void read(T& value) {
+
+		static_assert(
+				std::is_trivially_copyable<T>::value,
+				"only trivially copyable types can be read directly");
+
+		readBytes(&value, sizeof(T));
+		skipPadding();
+	}
+
+	template <typename T>
+	void read(std::vector<T>& values) {
+
+		static_assert(
+				std::is_trivially_copyable<T>::value,
+				"only vectors of trivially copyable types can be read directly");
+
+		values.resize(readSize(sizeof(T)));
+		readBytes(values.data(), values.size()*sizeof(T));
+		skipPadding();
+	}
+
+	/**
+	 * Read an array of known size written by writeArray() or as a vector.
+	 */
+	template <typename T>
+	void readArray(T* data, std::size_t size) {
+
+		static_assert(
+				std::is_trivially_copyable<T>::value,
+				"only arrays of trivially copyable types can be read directly");
+
+		if (readSize(sizeof(T)) != size)
+			throw std::runtime_error("unexpected array size in stream");
+
+		readBytes(data, size*sizeof(T));
+		skipPadding();
+	}
+
+	void read(std::vector<bool>& values) {
+
+		std::vector<uint8_t> bytes;
+		read(bytes);
+		values.assign(bytes.begin(), bytes.end());
+	}
+
+	template <typename T>
+	void read(std::vector<std::vector<T>>& values) {
+
+		std::vector<uint64_t> offsets;
+		std::vector<T> all;
+		read(offsets);
+		read(all);
+
+		if (offsets.empty() || offsets.back() != all.size())
+			throw std::runtime_error("corrupt nested array in stream");
+
+		values.resize(offsets.size() - 1);
+		for (std::size_t i = 0; i < values.size(); i++) {
+
+			if (offsets[i] > offsets[i + 1])
+				throw std::runtime_error("corrupt nested array in stream");
+
+			values[i].assign(all.begin() + offsets[i], all.begin() + offsets[i + 1]);
+		}
+	}
+
+	void read(std::string& value) {
+
+		std::vector<char> chars;
+		read(chars);
+		value.assign(chars.begin(), chars.end());
+	}
+
+private:
+
+	std::size_t readSize(std::size_t elementSize) {
+
+		uint64_t size;
+		read(size);
+
+		// guard against allocating huge arrays for corrupt files
+		std::streampos pos = _in.tellg();
+		if (pos != std::streampos(-1)) {
+
+			_in.seekg(0, std::ios::end);
+			std::streampos end = _in.tellg();
+			_in.seekg(pos);
+
+			if (elementSize > 0 && size > uint64_t(end - pos)/elementSize)
+				throw std::runtime_error("truncated stream");
+		}
+
+		return size;
+	}
+
+	void readBytes(void* data, std::size_t size) {
+
+		_in.read(static_cast<char*>(data), size);
+		_offset += size;
+
+		if (!_in)
+			throw std::runtime_error("truncated stream");
+	}
+
+	void skipPadding() {
+
+		char padding[8];
+
+		if (_offset % 8 != 0)
+			readBytes(padding, 8 - _offset % 8);
+	}
+
+	std::istream& _in;
+	std::size_t _offset;
+};
+
+#endif // WATERZ_SERIALIZATION_H__
+
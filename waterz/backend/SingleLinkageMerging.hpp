@@ -0,0 +1,311 @@
+#ifndef WATERZ_SINGLE_LINKAGE_MERGING_H__
+#define WATERZ_SINGLE_LINKAGE_MERGING_H__
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "RegionGraph.hpp"
+#include "MergeFunctions.hpp"
+#include "Operators.hpp"
+#include "Parallel.hpp"
+#include "UnionFind.hpp"
+#include "Logging.hpp"
+
+/**
+ * Scoring functions for which the score of an edge between two merged regions
+ * is the minimum of the scores of the edges between them. Region merging with
+ * these scoring functions is single-linkage clustering, see
+ * SingleLinkageMerging.
+ */
+template <typename ScoringFunctionType>
+struct IsSingleLinkage : std::false_type {};
+
+template <typename RegionGraphType, typename Precision>
+struct IsSingleLinkage<OneMinus<MaxAffinity<RegionGraphType, Precision>>> : std::true_type {};
+
+template <typename RegionGraphType, typename Precision>
+struct IsSingleLinkage<MinAffinity<RegionGraphType, Precision>> : std::true_type {};
+
+/**
+ * Region merging for single-linkage scoring functions (see IsSingleLinkage).
+ * Edge scores never change after merging other than by taking the minimum,
+ * such that the edges can be sorted once and merged in this order with a
+ * union-find (Kruskal's algorithm). Has the same interface as
+ * IterativeRegionMerging.
+ *
+ * Merging until a threshold t merges exactly the connected components of the
+ * edges with scores below t. Statistics are not updated while merging.
+ */
+template <typename NodeIdType, typename ScoreType>
+class SingleLinkageMerging {
+
+public:
+
+	typedef RegionGraph<NodeIdType>              RegionGraphType;
+	typedef typename RegionGraphType::EdgeType   EdgeType;
+	typedef typename RegionGraphType::EdgeIdType EdgeIdType;
+
+	SingleLinkageMerging(RegionGraphType& initialRegionGraph) :
+		_regionGraph(initialRegionGraph),
+		_regions(initialRegionGraph.numNodes()),
+		_next(0),
+		_mergedUntil(std::numeric_limits<ScoreType>::lowest()) {}
+
+	/**
+	 * Merge all edges with a score below the given threshold, cheapest edge
+	 * first.
+	 */
+	template <typename EdgeScoringFunction, typename StatisticsProviderType, typename Visitor>
+	std::size_t mergeUntil(
+			EdgeScoringFunction& edgeScoringFunction,
+			StatisticsProviderType&,
+			ScoreType threshold,
+			Visitor& visitor) {
+
+		if (threshold <= _mergedUntil) {
+
+			WATERZ_LOG << "already merged until " << threshold << ", skipping" << std::endl;
+			return 0;
+		}
+
+		if (_mergedUntil == std::numeric_limits<ScoreType>::lowest()) {
+
+			WATERZ_LOG << "computing and sorting initial scores" << std::endl;
+
+			sortEdges(edgeScoringFunction);
+		}
+
+		WATERZ_LOG << "merging until " << threshold << std::endl;
+
+		std::size_t merged = 0;
+		for (; _next < _edges.size() && _edges[_next].score < threshold; _next++) {
+
+			EdgeIdType e = _edges[_next].edge;
+			ScoreType score = _edges[_next].score;
+
+			visitor.onPop(e, score);
+
+			NodeIdType a = _regions.find(_regionGraph.edge(e).u);
+			NodeIdType b = _regions.find(_regionGraph.edge(e).v);
+
+			// the edge is part of a region already, as if it got deleted by a
+			// previous merge
+			if (a == b) {
+
+				visitor.onDeletedEdgeFound(e);
+				continue;
+			}
+
+			NodeIdType c = _regions.merge(a, b);
+			merged++;
+
+			visitor.onMerge(e, a, b, c, score);
+		}
+
+		WATERZ_LOG << "merged " << merged << " edges" << std::endl;
+
+		_mergedUntil = threshold;
+
+		return merged;
+	}
+
+	/**
+	 * Same as mergeUntil(), merging single-linkage is fast enough without 
+	 * batches.
+	 */
+	template <typename EdgeScoringFunction, typename StatisticsProviderType, typename Visitor>
+	std::size_t mergeUntilInBatches(
+			EdgeScoringFunction& edgeScoringFunction,
+			StatisticsProviderType& statisticsProvider,
+			ScoreType threshold,
+			Visitor& visitor,
+			std::size_t) {
+
+		return mergeUntil(edgeScoringFunction, statisticsProvider, threshold, visitor);
+	}
+
+	/**
+	 * The number of edges that have not been considered for merging, yet.
+	 */
+	std::size_t queueSize() const {
+
+		return _edges.size() - _next;
+	}
+
+	ScoreType mergedUntil() const {
+
+		return _mergedUntil;
+	}
+
+	/**
+	 * Write the state of merging (sorted edges, regions, and merge level). The
+	 * region graph has to be saved separately. Scores and edge IDs are
+	 * written as separate arrays, to not write the padding bytes of
+	 * ScoredEdgeId.
+	 */
+	template <typename Writer>
+	void save(Writer& writer) const {
+
+		std::vector<ScoreType> scores;
+		std::vector<EdgeIdType> edges;
+		scores.reserve(_edges.size());
+		edges.reserve(_edges.size());
+
+		for (const ScoredEdgeId& scoredEdge : _edges) {
+
+			scores.push_back(scoredEdge.score);
+			edges.push_back(scoredEdge.edge);
+		}
+
+		writer.write(scores);
+		writer.write(edges);
+		writer.write(static_cast<uint64_t>(_next));
+		_regions.save(writer);
+		writer.write(_mergedUntil);
+	}
+
+	/**
+	 * Read the state written by save(). The region graph this region merging
+	 * was created for has to be the one that was saved with it.
+	 */
+	template <typename Reader>
+	void load(Reader& reader) {
+
+		std::vector<ScoreType> scores;
+		std::vector<EdgeIdType> edges;
+		uint64_t next;
+
+		reader.read(scores);
+		reader.read(edges);
+		reader.read(next);
+		_regions.load(reader);
+		reader.read(_mergedUntil);
+
+		if (scores.size() != edges.size() || next > edges.size() || _regions.size() != _regionGraph.numNodes())
+			throw std::runtime_error("corrupt single-linkage state");
+
+		_edges.resize(edges.size());
+		for (std::size_t i = 0; i < edges.size(); i++) {
+
+			if (edges[i] >= _regionGraph.numEdges())
+				throw std::runtime_error("corrupt single-linkage state");
+
+			_edges[i].score = scores[i];
+			_edges[i].edge  = edges[i];
+		}
+
+		_next = next;
+	}
+
+	/**
+	 * Get the segmentation corresponding to the current merge level.
+	 *
+	 * The provided segmentation has to hold the initial segmentation, or any
+	 * segmentation created by previous calls to extractSegmentation().
+	 */
+	template <typename SegmentationVolume>
+	void extractSegmentation(SegmentationVolume& segmentation) {
+
+		std::vector<NodeIdType> roots(_regions.size());
+		for (std::size_t i = 0; i < roots.size(); i++)
+			roots[i] = _regions.find(i);
+
+		for (std::size_t i = 0; i < segmentation.num_elements(); i++)
+			segmentation.data()[i] = roots[segmentation.data()[i]];
+	}
+
+	/**
+	 * Get the region graph corresponding to the current merge level. The score
+	 * of an edge between two regions is the lowest score of the initial edges
+	 * between them.
+	 */
+	template <typename ScoredEdge, typename EdgeScoringFunction>
+	std::vector<ScoredEdge> extractRegionGraph(EdgeScoringFunction&) {
+
+		std::vector<ScoredEdge> edges;
+
+		// all remaining edges have scores not below _mergedUntil
+		for (std::size_t i = _next; i < _edges.size(); i++) {
+
+			NodeIdType u = _regions.find(_regionGraph.edge(_edges[i].edge).u);
+			NodeIdType v = _regions.find(_regionGraph.edge(_edges[i].edge).v);
+
+			if (u != v)
+				edges.push_back(ScoredEdge(std::min(u, v), std::max(u, v), _edges[i].score));
+		}
+
+		// keep the cheapest edge between each pair of regions
+		std::stable_sort(edges.begin(), edges.end(), [](const ScoredEdge& a, const ScoredEdge& b) {
+			return a.u < b.u || (a.u == b.u && a.v < b.v);
+		});
+		edges.erase(
+				std::unique(edges.begin(), edges.end(), [](const ScoredEdge& a, const ScoredEdge& b) {
+					return a.u == b.u && a.v == b.v;
+				}),
+				edges.end());
+
+		return edges;
+	}
+
+private:
+
+	struct ScoredEdgeId {
+
+		ScoreType  score;
+		EdgeIdType edge;
+
+		// ties are broken by edge ID, to make the order deterministic
+		bool operator<(const ScoredEdgeId& other) const {
+
+			return score < other.score || (score == other.score && edge < other.edge);
+		}
+	};
+
+	/**
+	 * Score all edges and sort them, both in parallel. Edges are scored
+	 * serially if the statistics provider of the scoring function is not
+	 * ThreadSafe.
+	 */
+	template <typename EdgeScoringFunction>
+	void sortEdges(EdgeScoringFunction& edgeScoringFunction) {
+
+		std::size_t numEdges = _regionGraph.numEdges();
+
+		_edges.resize(numEdges);
+
+		bool parallel = EdgeScoringFunction::StatisticsProviderType::ThreadSafe;
+
+		parallelForIf(parallel, numEdges, [this, &edgeScoringFunction](std::size_t begin, std::size_t end) {
+
+			for (EdgeIdType e = begin; e < end; e++) {
+
+				_edges[e].score = edgeScoringFunction(e);
+				_edges[e].edge  = e;
+			}
+		});
+
+		parallelSort(_edges.begin(), _edges.end(), std::less<ScoredEdgeId>());
+
+		_next = 0;
+	}
+
+	RegionGraphType& _regionGraph;
+
+	// all edges in the order of merging
+	std::vector<ScoredEdgeId> _edges;
+
+	// the regions each initial region is part of
+	UnionFind<NodeIdType> _regions;
+
+	// the next edge to consider for merging
+	std::size_t _next;
+
+	// current state of merging
+	ScoreType _mergedUntil;
+};
+
+#endif // WATERZ_SINGLE_LINKAGE_MERGING_H__
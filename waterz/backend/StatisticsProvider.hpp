@@ -21,9 +21,39 @@ public:
 	template <typename EdgeIdType, typename ScoreType>
 	inline void addAffinity(EdgeIdType e, ScoreType affinity) {}
 
+	/**
+	 * Whether the statistics can be read concurrently from several threads, 
+	 * and notifyNodeMerge() and notifyEdgeMerge() can be called concurrently 
+	 * for disjoint nodes and edges. Initial edge scores are computed in 
+	 * parallel, and batches of merges (see 
+	 * IterativeRegionMerging::mergeUntilInBatches()) are performed in 
+	 * parallel, only for scoring functions whose providers are thread-safe. 
+	 * Providers that keep state shared between nodes or edges have to set 
+	 * this to false.
+	 */
+	static const bool ThreadSafe = true;
+
+	/**
+	 * Whether this provider needs addVoxel() to be called for every voxel. 
+	 * Providers that only need the size of each node get them from 
+	 * initNodeSizes() instead, and should leave this false.
+	 */
+	static const bool NeedsVoxels = false;
+
+	/**
+	 * Callback for adding a voxel to a node. Only called if NeedsVoxels is 
+	 * true.
+	 */
 	template <typename NodeIdType>
 	inline void addVoxel(NodeIdType n, std::size_t x, std::size_t y, std::size_t z) {}
 
+	/**
+	 * Initialize the sizes of all nodes at once. Called instead of addVoxel(), 
+	 * if NeedsVoxels is false.
+	 */
+	template <typename SizeType>
+	inline void initNodeSizes(const SizeType* sizes, std::size_t numNodes) {}
+
 	/**
 	 * Callback for node merges: 'from' will be merged into 'to'. Return true, 
 	 * if this changed the statistics of this provider.
@@ -37,6 +67,28 @@ public:
 	 */
 	template<typename EdgeIdType>
 	inline bool notifyEdgeMerge(EdgeIdType from, EdgeIdType to) { return false; }
+
+	/**
+	 * Initialize the statistics of all nodes and edges from precomputed 
+	 * values (see StatisticsSeeds.hpp), instead of adding voxels and 
+	 * affinities. Called after all edges were added.
+	 */
+	template <typename Seeds>
+	inline void seed(const Seeds& seeds) {}
+
+	/**
+	 * Write the statistics to a BinaryWriter. Providers with state have to 
+	 * implement this and load().
+	 */
+	template <typename Writer>
+	inline void save(Writer& writer) const {}
+
+	/**
+	 * Read the statistics written by save(). Called after the region graph 
+	 * was loaded.
+	 */
+	template <typename Reader>
+	inline void load(Reader& reader) {}
 };
 
 #endif // WATERZ_STATISTICS_PROVIDER_H__
@@ -0,0 +1,68 @@
+#ifndef WATERZ_STATISTICS_SEEDS_H__
+#define WATERZ_STATISTICS_SEEDS_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+/**
+ * Precomputed statistics of nodes and edges, to initialize statistics
+ * providers without reading voxel data (see StatisticsProvider::seed()).
+ *
+ * All arrays are optional (NULL if not given) and indexed by node or edge ID.
+ * Providers throw std::invalid_argument, if a statistic they need is missing.
+ */
+template <typename Precision>
+struct StatisticsSeeds {
+
+	StatisticsSeeds() :
+		numNodes(0),
+		numEdges(0),
+		regionSizes(NULL),
+		contactAreas(NULL),
+		meanAffinities(NULL),
+		maxAffinities(NULL),
+		minAffinities(NULL),
+		histograms(NULL),
+		histogramBins(0),
+		maxKAffinities(NULL),
+		maxK(0) {}
+
+	std::size_t numNodes;
+	std::size_t numEdges;
+
+	// number of voxels of each node
+	const uint64_t*  regionSizes;
+
+	// number of affinities of each edge
+	const uint64_t*  contactAreas;
+
+	const Precision* meanAffinities;
+	const Precision* maxAffinities;
+	const Precision* minAffinities;
+
+	// numEdges x histogramBins histograms of affinities in [0,1]
+	const uint32_t*  histograms;
+	std::size_t      histogramBins;
+
+	// numEdges x maxK largest affinities of each edge, in any order, padded
+	// with std::numeric_limits<Precision>::lowest() for edges with less than
+	// maxK affinities
+	const Precision* maxKAffinities;
+	std::size_t      maxK;
+
+	/**
+	 * Get the given array, or throw if it was not given.
+	 */
+	template <typename T>
+	static const T* require(const T* array, const std::string& name) {
+
+		if (array == NULL)
+			throw std::invalid_argument("the statistics provider requires " + name);
+
+		return array;
+	}
+};
+
+#endif // WATERZ_STATISTICS_SEEDS_H__
@@ -0,0 +1,94 @@
+#ifndef WATERZ_UNION_FIND_H__
+#define WATERZ_UNION_FIND_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+ * Disjoint sets over the IDs 0 to n-1, with union by rank and path halving.
+ */
+template <typename ID>
+class UnionFind {
+
+public:
+
+	UnionFind(std::size_t n = 0) {
+
+		reset(n);
+	}
+
+	/**
+	 * Put each ID in its own set.
+	 */
+	void reset(std::size_t n) {
+
+		_parents.resize(n);
+		_ranks.assign(n, 0);
+
+		for (std::size_t i = 0; i < n; i++)
+			_parents[i] = i;
+	}
+
+	std::size_t size() const { return _parents.size(); }
+
+	/**
+	 * Get the representative of the set containing id.
+	 */
+	inline ID find(ID id) {
+
+		while (_parents[id] != id) {
+
+			_parents[id] = _parents[_parents[id]];
+			id = _parents[id];
+		}
+
+		return id;
+	}
+
+	/**
+	 * Merge the sets with the representatives a and b. Returns the
+	 * representative of the merged set, which is either a or b.
+	 */
+	inline ID merge(ID a, ID b) {
+
+		if (_ranks[a] < _ranks[b])
+			std::swap(a, b);
+
+		_parents[b] = a;
+		if (_ranks[a] == _ranks[b])
+			_ranks[a]++;
+
+		return a;
+	}
+
+	template <typename Writer>
+	void save(Writer& writer) const {
+
+		writer.write(_parents);
+		writer.write(_ranks);
+	}
+
+	template <typename Reader>
+	void load(Reader& reader) {
+
+		reader.read(_parents);
+		reader.read(_ranks);
+
+		if (_ranks.size() != _parents.size())
+			throw std::runtime_error("corrupt union-find");
+
+		for (ID parent : _parents)
+			if (parent >= _parents.size())
+				throw std::runtime_error("corrupt union-find");
+	}
+
+private:
+
+	std::vector<ID>      _parents;
+	std::vector<uint8_t> _ranks;
+};
+
+#endif // WATERZ_UNION_FIND_H__
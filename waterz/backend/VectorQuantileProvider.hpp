@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <algorithm>
+#include <stdexcept>
 #include "StatisticsProvider.hpp"
 
 /**
@@ -58,6 +59,26 @@ public:
 		return *quantile;
 	}
 
+	template <typename Seeds>
+	inline void seed(const Seeds& seeds) {
+
+		throw std::invalid_argument(
+				"exact quantiles need all affinities and can not be seeded, use "
+				"HistogramQuantileProvider instead");
+	}
+
+	template <typename Writer>
+	inline void save(Writer& writer) const {
+
+		_values.save(writer);
+	}
+
+	template <typename Reader>
+	inline void load(Reader& reader) {
+
+		_values.load(reader);
+	}
+
 private:
 
 	template <typename It>
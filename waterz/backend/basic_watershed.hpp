@@ -1,40 +1,50 @@
 #pragma once
 
 #include "types.hpp"
+#include "Logging.hpp"
+#include "Parallel.hpp"
 
+#include <cstdint>
 #include <iostream>
+#include <limits>
+#include <vector>
 
 /**
- * Perform a watershed segmentation on an affinity graph.
- *
- * @param aff [in]
- *              A multi-array holding the affinity graph with shape 
- *              (3,depth,height,width).
- * @param low [in]
- * @param high [in]
- * @param seg [out]
- *              A reference to a segmentation multi-array that will be used to 
- *              store the segmentation. The caller has to ensure it is of the 
- *              correct shape (depth,height,width).
- * @param counts [out]
- *              A reference to a counts_t data structure that will be used to 
- *              store the sizes of the found regions.
+ * A visitor for the final labelling pass of watershed() that does nothing.
  */
-template<typename AG, typename V>
+struct watershed_no_visitor
+{
+    /**
+     * Called once the regions are found, before the final pass.
+     */
+    void begin(const counts_t<std::size_t>& counts) {}
+
+    /**
+     * Called for each voxel in memory order, as soon as its final ID is set.
+     * The IDs of all previous voxels are final as well.
+     */
+    template<typename ID>
+    void label(const ID* seg, std::ptrdiff_t idx, std::ptrdiff_t z, std::ptrdiff_t y, std::ptrdiff_t x) {}
+};
+
+/**
+ * Perform a watershed segmentation on an affinity graph, using Index for 
+ * voxel indices in the BFS queues. See watershed().
+ */
+template<typename Index, typename AG, typename V, typename Visitor>
 inline
 void
-watershed(
+watershed_with_index(
         const AG& aff,
         typename AG::element low,
         typename AG::element high,
         V& seg,
-        counts_t<std::size_t>& counts)
+        counts_t<std::size_t>& counts,
+        Visitor& visitor)
 {
     typedef typename AG::element F;
     typedef typename V::element  ID;
 
-    using traits = watershed_traits<ID>;
-
     std::ptrdiff_t zdim = aff.shape()[1];
     std::ptrdiff_t ydim = aff.shape()[2];
     std::ptrdiff_t xdim = aff.shape()[3];
@@ -50,11 +60,18 @@ watershed(
 
     ID* seg_raw = seg.data();
 
+    // directions to follow (0x3f), visited (0x40), and labelled (0x80) bits
+    // per voxel, the labels are only written to seg
+    const uint8_t visited  = 0x40;
+    const uint8_t labelled = 0x80;
+    std::vector<uint8_t> dirs(size, 0);
+
+    std::ptrdiff_t i = 0;
     for ( std::ptrdiff_t z = 0; z < zdim; ++z )
         for ( std::ptrdiff_t y = 0; y < ydim; ++y )
-            for ( std::ptrdiff_t x = 0; x < xdim; ++x )
+            for ( std::ptrdiff_t x = 0; x < xdim; ++x, ++i )
             {
-                ID& id = seg[z][y][x] = 0;
+                uint8_t& id = dirs[i];
 
                 F negz = (z>0) ? aff[0][z][y][x] : low;
                 F negy = (y>0) ? aff[1][z][y][x] : low;
@@ -79,22 +96,22 @@ watershed(
 
     //                              -z          -y     -x  +z         +y    +x
     const std::ptrdiff_t dir[6] = { -ydim*xdim, -xdim, -1, ydim*xdim, xdim, 1 };
-    const ID dirmask[6]  = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20 };
-    const ID idirmask[6] = { 0x08, 0x10, 0x20, 0x01, 0x02, 0x04 };
+    const uint8_t dirmask[6]  = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20 };
+    const uint8_t idirmask[6] = { 0x08, 0x10, 0x20, 0x01, 0x02, 0x04 };
 
     // get plato corners
 
-    std::vector<std::ptrdiff_t> bfs;
+    std::vector<Index> bfs;
 
     for ( std::ptrdiff_t idx = 0; idx < size; ++idx )
     {
         for ( std::ptrdiff_t d = 0; d < 6; ++d )
         {
-            if ( seg_raw[idx] & dirmask[d] )
+            if ( dirs[idx] & dirmask[d] )
             {
-                if ( !(seg_raw[idx+dir[d]] & idirmask[d]) )
+                if ( !(dirs[idx+dir[d]] & idirmask[d]) )
                 {
-                    seg_raw[idx] |= 0x40;
+                    dirs[idx] |= visited;
                     bfs.push_back(idx);
                     d = 6; // break;
                 }
@@ -110,18 +127,18 @@ watershed(
     {
         std::ptrdiff_t idx = bfs[bfs_index];
 
-        ID to_set = 0;
+        uint8_t to_set = 0;
 
         for ( std::ptrdiff_t d = 0; d < 6; ++d )
         {
-            if ( seg_raw[idx] & dirmask[d] )
+            if ( dirs[idx] & dirmask[d] )
             {
-                if ( seg_raw[idx+dir[d]] & idirmask[d] )
+                if ( dirs[idx+dir[d]] & idirmask[d] )
                 {
-                    if ( !( seg_raw[idx+dir[d]] & 0x40 ) )
+                    if ( !( dirs[idx+dir[d]] & visited ) )
                     {
                         bfs.push_back(idx+dir[d]);
-                        seg_raw[idx+dir[d]] |= 0x40;
+                        dirs[idx+dir[d]] |= visited;
                     }
                 }
                 else
@@ -130,11 +147,12 @@ watershed(
                 }
             }
         }
-        seg_raw[idx] = to_set;
+        dirs[idx] = to_set;
         ++bfs_index;
     }
 
     bfs.clear();
+    bfs.shrink_to_fit();
 
     // main watershed logic
 
@@ -142,17 +160,18 @@ watershed(
 
     for ( std::ptrdiff_t idx = 0; idx < size; ++idx )
     {
-        if ( seg_raw[idx] == 0 )
+        if ( dirs[idx] == 0 )
         {
-            seg_raw[idx] |= traits::high_bit;
+            dirs[idx] = labelled;
+            seg_raw[idx] = 0;
             ++counts[0];
         }
 
-        if ( !( seg_raw[idx] & traits::high_bit ) && seg_raw[idx] )
+        if ( !( dirs[idx] & labelled ) )
         {
             bfs.push_back(idx);
             bfs_index = 0;
-            seg_raw[idx] |= 0x40;
+            dirs[idx] |= visited;
 
             while ( bfs_index < bfs.size() )
             {
@@ -160,25 +179,27 @@ watershed(
 
                 for ( std::ptrdiff_t d = 0; d < 6; ++d )
                 {
-                    if ( seg_raw[me] & dirmask[d] )
+                    if ( dirs[me] & dirmask[d] )
                     {
                         std::ptrdiff_t him = me + dir[d];
-                        if ( seg_raw[him] & traits::high_bit )
+                        if ( dirs[him] & labelled )
                         {
-                            counts[ seg_raw[him] & ~traits::high_bit ]
-                                += bfs.size();
+                            ID label = seg_raw[him];
+
+                            counts[label] += bfs.size();
 
                             for ( auto& it: bfs )
                             {
-                                seg_raw[it] = seg_raw[him];
+                                seg_raw[it] = label;
+                                dirs[it] = labelled;
                             }
 
                             bfs.clear();
                             d = 6; // break
                         }
-                        else if ( !( seg_raw[him] & 0x40 ) )
+                        else if ( !( dirs[him] & visited ) )
                         {
-                            seg_raw[him] |= 0x40;
+                            dirs[him] |= visited;
                             bfs.push_back( him );
 
                         }
@@ -192,7 +213,8 @@ watershed(
                 counts.push_back( bfs.size() );
                 for ( auto& it: bfs )
                 {
-                    seg_raw[it] = traits::high_bit | next_id;
+                    seg_raw[it] = next_id;
+                    dirs[it] = labelled;
                 }
                 ++next_id;
                 bfs.clear();
@@ -200,10 +222,144 @@ watershed(
         }
     }
 
-    std::cout << "found: " << (next_id-1) << " components\n";
+    WATERZ_LOG << "found: " << (next_id-1) << " components\n";
 
-    for ( std::ptrdiff_t idx = 0; idx < size; ++idx )
+    // release the direction field before the final pass
+    dirs.clear();
+    dirs.shrink_to_fit();
+
+    visitor.begin(counts);
+
+    std::ptrdiff_t idx = 0;
+    for ( std::ptrdiff_t z = 0; z < zdim; ++z )
+        for ( std::ptrdiff_t y = 0; y < ydim; ++y )
+            for ( std::ptrdiff_t x = 0; x < xdim; ++x, ++idx )
+                visitor.label(seg_raw, idx, z, y, x);
+}
+
+/**
+ * Perform a watershed segmentation on an affinity graph.
+ *
+ * Directions and BFS state are kept in a separate field of one byte per 
+ * voxel, seg is only written once with the final labels. BFS queues use 
+ * 32-bit indices for volumes with less than 2^32 voxels.
+ *
+ * @param aff [in]
+ *              A multi-array holding the affinity graph with shape 
+ *              (3,depth,height,width).
+ * @param low [in]
+ * @param high [in]
+ * @param seg [out]
+ *              A reference to a segmentation multi-array that will be used to 
+ *              store the segmentation. The caller has to ensure it is of the 
+ *              correct shape (depth,height,width).
+ * @param counts [out]
+ *              A reference to a counts_t data structure that will be used to 
+ *              store the sizes of the found regions.
+ * @param visitor [in]
+ *              A visitor for the final labelling pass, see 
+ *              watershed_no_visitor.
+ */
+template<typename AG, typename V, typename Visitor>
+inline
+void
+watershed(
+        const AG& aff,
+        typename AG::element low,
+        typename AG::element high,
+        V& seg,
+        counts_t<std::size_t>& counts,
+        Visitor& visitor)
+{
+    std::size_t size = aff.shape()[1] * aff.shape()[2] * aff.shape()[3];
+
+    if ( size <= std::numeric_limits<uint32_t>::max() )
+        watershed_with_index<uint32_t>(aff, low, high, seg, counts, visitor);
+    else
+        watershed_with_index<std::ptrdiff_t>(aff, low, high, seg, counts, visitor);
+}
+
+template<typename AG, typename V>
+inline
+void
+watershed(
+        const AG& aff,
+        typename AG::element low,
+        typename AG::element high,
+        V& seg,
+        counts_t<std::size_t>& counts)
+{
+    watershed_no_visitor visitor;
+    watershed(aff, low, high, seg, counts, visitor);
+}
+
+/**
+ * Perform a watershed segmentation independently on each z-slice of an 
+ * affinity graph, ignoring the affinities along z (channel 0). Slices are 
+ * processed in parallel. The IDs of each slice are offset by the number of 
+ * regions in the previous slices, such that IDs are unique and do not depend 
+ * on the number of threads.
+ *
+ * Arguments are the same as for watershed().
+ */
+template<typename AG, typename V>
+inline
+void
+watershed_2d(
+        const AG& aff,
+        typename AG::element low,
+        typename AG::element high,
+        V& seg,
+        counts_t<std::size_t>& counts)
+{
+    typedef typename V::element ID;
+    typedef boost::multi_array_types::index_range range;
+
+    std::ptrdiff_t zdim = aff.shape()[1];
+    std::ptrdiff_t ydim = aff.shape()[2];
+    std::ptrdiff_t xdim = aff.shape()[3];
+
+    std::ptrdiff_t slice_size = ydim * xdim;
+
+    std::vector<counts_t<std::size_t>> slice_counts(zdim);
+
+    parallelFor(zdim, [&](std::size_t begin, std::size_t end) {
+
+        for ( std::ptrdiff_t z = begin; z < end; ++z )
+        {
+            auto slice_aff = aff[boost::indices[range()][range(z, z+1)][range()][range()]];
+            volume_ref<ID> slice_seg(
+                    seg.data() + z*slice_size,
+                    boost::extents[1][ydim][xdim]);
+
+            watershed(slice_aff, low, high, slice_seg, slice_counts[z]);
+        }
+    }, 1);
+
+    // offset the IDs of each slice by the regions found in previous slices
+
+    std::vector<ID> offsets(zdim, 0);
+
+    counts.resize(1);
+    counts[0] = 0;
+
+    for ( std::ptrdiff_t z = 0; z < zdim; ++z )
     {
-        seg_raw[idx] &= traits::mask;
+        offsets[z] = counts.size() - 1;
+        counts[0] += slice_counts[z][0];
+        counts.insert(counts.end(), slice_counts[z].begin() + 1, slice_counts[z].end());
     }
+
+    ID* seg_raw = seg.data();
+
+    parallelFor(zdim, [&](std::size_t begin, std::size_t end) {
+
+        for ( std::ptrdiff_t z = begin; z < end; ++z )
+            for ( std::ptrdiff_t idx = z*slice_size; idx < (z+1)*slice_size; ++idx )
+                if ( seg_raw[idx] )
+                    seg_raw[idx] += offsets[z];
+    }, 1);
+
+    WATERZ_LOG << "found: " << (counts.size()-1) << " components in " << zdim << " slices\n";
 }
+
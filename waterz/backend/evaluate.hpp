@@ -6,6 +6,8 @@
 #include <map>
 #include <math.h> 
 
+#include "Logging.hpp"
+
 using namespace std;
 
 template <typename V1, typename V2>
@@ -100,10 +102,10 @@ compare_volumes(
 	// H(t|s)
 	double voi_merge = H_st - H_s;
 
-	std::cout << "\tRand split: " << rand_split << "\n";
-	std::cout << "\tRand merge: " << rand_merge << "\n";
-	std::cout << "\tVOI split: " << voi_split << "\n";
-	std::cout << "\tVOI merge: " << voi_merge << "\n";
+	WATERZ_LOG << "\tRand split: " << rand_split << "\n";
+	WATERZ_LOG << "\tRand merge: " << rand_merge << "\n";
+	WATERZ_LOG << "\tVOI split: " << voi_split << "\n";
+	WATERZ_LOG << "\tVOI merge: " << voi_merge << "\n";
 
 	return std::make_tuple(
 			rand_split,
@@ -0,0 +1,161 @@
+#pragma once
+
+#include "types.hpp"
+#include "RegionGraph.hpp"
+#include "region_graph.hpp"
+#include "Parallel.hpp"
+#include "UnionFind.hpp"
+#include "Logging.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Merge fragments smaller than a size threshold into their neighbors,
+ * strongest affinity first (like the size-based merging of zwatershed).
+ *
+ * The pairs of fragments in contact are visited in decreasing order of their
+ * maximal affinity, down to aff_threshold. Two fragments are merged, if at
+ * least one of them (including everything merged into it so far) is smaller
+ * than size_threshold. The background (ID 0) is never merged. Fragments are
+ * relabelled consecutively afterwards, in the order of their lowest IDs.
+ *
+ * @param aff [in]
+ *              The affinity graph the fragments were found on.
+ * @param seg [in, out]
+ *              The fragments, with IDs 0 to counts.size()-1.
+ * @param counts [in, out]
+ *              The sizes of the fragments, as computed by watershed().
+ * @param size_threshold [in]
+ *              Fragments smaller than this are merged.
+ * @param aff_threshold [in]
+ *              Only contacts with at least this affinity are merged.
+ * @return The number of merges.
+ */
+template<typename AG, typename V>
+inline
+std::size_t
+merge_small_fragments(
+		const AG& aff,
+		V& seg,
+		counts_t<std::size_t>& counts,
+		std::size_t size_threshold,
+		typename AG::element aff_threshold) {
+
+	typedef typename AG::element F;
+	typedef typename V::element ID;
+
+	struct contact {
+
+		F  affinity;
+		ID u;
+		ID v;
+
+		// strongest contact first, ties are broken by IDs to make the order
+		// deterministic
+		bool operator<(const contact& other) const {
+
+			return
+					affinity > other.affinity || (affinity == other.affinity && (
+					u < other.u || (u == other.u &&
+					v < other.v)));
+		}
+	};
+
+	typedef std::pair<ID, ID> fragment_pair;
+
+	struct fragment_pair_hash {
+
+		std::size_t operator()(const fragment_pair& p) const {
+
+			return std::hash<unsigned long long>()(
+					static_cast<unsigned long long>(p.first)*0x9E3779B97F4A7C15ull ^ p.second);
+		}
+	};
+
+	// the strongest contact between each pair of fragments, contacts between
+	// two fragments of at least size_threshold never lead to a merge, since
+	// sizes only grow
+	std::unordered_map<fragment_pair, F, fragment_pair_hash> max_affinities;
+	visit_contacts(
+			aff,
+			seg,
+			[](const segment_run<ID>&, std::ptrdiff_t, std::ptrdiff_t) {},
+			[&](ID id1, ID id2, F affinity) {
+
+				if (id1 == 0 || id2 == 0 || affinity < aff_threshold)
+					return;
+				if (counts[id1] >= size_threshold && counts[id2] >= size_threshold)
+					return;
+
+				auto inserted = max_affinities.insert(
+						std::make_pair(fragment_pair(std::min(id1, id2), std::max(id1, id2)), affinity));
+				if (!inserted.second)
+					inserted.first->second = std::max(inserted.first->second, affinity);
+			});
+
+	std::vector<contact> contacts;
+	contacts.reserve(max_affinities.size());
+	for (const auto& p : max_affinities)
+		contacts.push_back({p.second, p.first.first, p.first.second});
+	max_affinities.clear();
+
+	parallelSort(contacts.begin(), contacts.end(), std::less<contact>());
+
+	UnionFind<ID> fragments(counts.size());
+	std::vector<std::size_t> sizes(counts.begin(), counts.end());
+	std::size_t merged = 0;
+
+	for (const contact& c : contacts) {
+
+		ID a = fragments.find(c.u);
+		ID b = fragments.find(c.v);
+
+		if (a == b || (sizes[a] >= size_threshold && sizes[b] >= size_threshold))
+			continue;
+
+		ID root = fragments.merge(a, b);
+		sizes[root] = sizes[a] + sizes[b];
+		merged++;
+	}
+
+	WATERZ_LOG << "merged " << merged << " small fragments" << std::endl;
+
+	if (merged == 0)
+		return 0;
+
+	// consecutive IDs in the order of the lowest ID of each fragment
+	std::vector<ID> labels(counts.size(), 0);
+	std::vector<ID> root_labels(counts.size(), 0);
+	counts_t<std::size_t> merged_counts(1, counts[0]);
+
+	for (std::size_t id = 1; id < counts.size(); id++) {
+
+		ID root = fragments.find(id);
+		if (root_labels[root] == 0) {
+
+			root_labels[root] = merged_counts.size();
+			merged_counts.push_back(0);
+		}
+
+		labels[id] = root_labels[root];
+		merged_counts[labels[id]] += counts[id];
+	}
+
+	ID* seg_raw = seg.data();
+	parallelFor(seg.num_elements(), [seg_raw, &labels](std::size_t begin, std::size_t end) {
+
+		for (std::size_t i = begin; i < end; i++)
+			seg_raw[i] = labels[seg_raw[i]];
+	});
+
+	WATERZ_LOG << "fragments after merging small ones: " << (merged_counts.size() - 1) << std::endl;
+
+	counts.swap(merged_counts);
+
+	return merged;
+}
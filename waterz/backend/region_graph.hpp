@@ -1,15 +1,250 @@
 #pragma once
 
 #include "types.hpp"
+#include "basic_watershed.hpp"
+#include "Logging.hpp"
 
+#include <algorithm>
 #include <cstddef>
 #include <iostream>
 #include <map>
+#include <vector>
+
+/**
+ * A maximal run of voxels with the same ID along x.
+ */
+template <typename ID>
+struct segment_run {
+
+	std::ptrdiff_t begin;
+	std::ptrdiff_t end;
+	ID id;
+};
+
+/**
+ * Run-length encode all rows of a slice of a segmentation along x.
+ *
+ * @param on_run [in]
+ *              Called with each run, its row, and its slice, in memory order.
+ * @param runs [out]
+ *              The runs of all rows, row after row.
+ * @param row_begin [out]
+ *              The index of the first run of each row in runs, with one more 
+ *              entry for the end of the last row.
+ */
+template <typename V, typename RunVisitor>
+inline
+void
+encode_slice(
+		const V& seg,
+		std::ptrdiff_t z,
+		RunVisitor& on_run,
+		std::vector<segment_run<typename V::element>>& runs,
+		std::vector<std::size_t>& row_begin) {
+
+	typedef typename V::element ID;
+
+	std::ptrdiff_t ydim = seg.shape()[1];
+	std::ptrdiff_t xdim = seg.shape()[2];
+	const auto* strides = seg.strides();
+
+	runs.clear();
+	row_begin.clear();
+
+	for (std::ptrdiff_t y = 0; y < ydim; ++y) {
+
+		row_begin.push_back(runs.size());
+
+		const ID* row = seg.data() + z*strides[0] + y*strides[1];
+
+		std::ptrdiff_t x = 0;
+		while (x < xdim) {
+
+			ID id = row[x*strides[2]];
+			std::ptrdiff_t begin = x;
+			while (x < xdim && row[x*strides[2]] == id)
+				++x;
+
+			runs.push_back({begin, x, id});
+			on_run(runs.back(), y, z);
+		}
+	}
+
+	row_begin.push_back(runs.size());
+}
+
+/**
+ * Find all contacts between different IDs in a segmentation.
+ *
+ * Each row of the segmentation along x is run-length encoded first. Boundaries 
+ * are found by intersecting the runs of a row with the runs of the previous 
+ * row and slice, such that affinities are only read at label transitions.
+ *
+ * @param aff [in]
+ *              The affinity graph to read the affinities from.
+ * @param seg [in]
+ *              The segmentation.
+ * @param on_run [in]
+ *              Called with each run of IDs along x, its row, and its slice, in 
+ *              memory order.
+ * @param on_contact [in]
+ *              Called with the IDs and the affinity of each pair of adjacent 
+ *              voxels with different IDs. The contacts are visited in memory 
+ *              order of the voxels, and along z, y, and x for each voxel.
+ */
+template<typename AG, typename V, typename RunVisitor, typename ContactVisitor>
+inline
+void
+visit_contacts(
+		const AG& aff,
+		const V& seg,
+		RunVisitor on_run,
+		ContactVisitor on_contact) {
+
+	typedef typename AG::element F;
+	typedef typename V::element ID;
+	typedef segment_run<ID> Run;
+
+	std::ptrdiff_t zdim = aff.shape()[1];
+	std::ptrdiff_t ydim = aff.shape()[2];
+	std::ptrdiff_t xdim = aff.shape()[3];
+	const auto* strides = aff.strides();
+
+	std::vector<Run> runs, prev_runs;
+	std::vector<std::size_t> row_begin, prev_row_begin;
+
+	for (std::ptrdiff_t z = 0; z < zdim; ++z) {
+
+		encode_slice(seg, z, on_run, runs, row_begin);
+
+		for (std::ptrdiff_t y = 0; y < ydim; ++y) {
+
+			const F* affs[3];
+			for (int d = 0; d < 3; d++)
+				affs[d] = aff.data() + d*strides[0] + z*strides[1] + y*strides[2];
+
+			// the runs of this row, the previous row, and the previous slice
+			const Run* run = &runs[row_begin[y]];
+			const Run* run_y = (y > 0 ? &runs[row_begin[y - 1]] : nullptr);
+			const Run* run_z = (z > 0 ? &prev_runs[prev_row_begin[y]] : nullptr);
+
+			// walk through the intervals in which all three runs are constant
+			std::ptrdiff_t x = 0;
+			while (x < xdim) {
+
+				ID id = run->id;
+				std::ptrdiff_t end = run->end;
+
+				bool boundary_z = false;
+				bool boundary_y = false;
+				if (run_z) {
+
+					end = std::min(end, run_z->end);
+					boundary_z = (run_z->id != id);
+				}
+				if (run_y) {
+
+					end = std::min(end, run_y->end);
+					boundary_y = (run_y->id != id);
+				}
+
+				// runs are maximal, so the start of a run is a boundary along x
+				bool boundary_x = (x > 0 && x == run->begin);
+
+				for (std::ptrdiff_t i = x; i < end && (boundary_z || boundary_y); ++i) {
+
+					if (boundary_z)
+						on_contact(id, run_z->id, affs[0][i*strides[3]]);
+					if (boundary_y)
+						on_contact(id, run_y->id, affs[1][i*strides[3]]);
+					if (boundary_x && i == x)
+						on_contact(id, (run - 1)->id, affs[2][i*strides[3]]);
+				}
+
+				if (boundary_x && !boundary_z && !boundary_y)
+					on_contact(id, (run - 1)->id, affs[2][x*strides[3]]);
+
+				x = end;
+				if (run->end == x)
+					++run;
+				if (run_z && run_z->end == x)
+					++run_z;
+				if (run_y && run_y->end == x)
+					++run_y;
+			}
+		}
+
+		std::swap(runs, prev_runs);
+		std::swap(row_begin, prev_row_begin);
+	}
+}
+
+/**
+ * The affinities between pairs of regions found while scanning a 
+ * segmentation, in the order they were found.
+ */
+template <typename ID, typename F>
+class region_contacts {
+
+public:
+
+	region_contacts(std::size_t max_segid = 0) :
+		_affinities(max_segid + 1) {}
+
+	void resize(std::size_t max_segid) {
+
+		_affinities.resize(max_segid + 1);
+	}
+
+	inline void add(ID id1, ID id2, F affinity) {
+
+		auto mm = std::minmax(id1, id2);
+
+		// edges to the background are not part of the region graph
+		if (mm.first != 0)
+			_affinities[mm.first][mm.second].push_back(affinity);
+	}
+
+	/**
+	 * Add an edge for each pair of regions in contact to the region graph, 
+	 * ordered by IDs, and pass the affinities to the statistics provider.
+	 */
+	template <typename StatisticsProviderType>
+	void add_edges(StatisticsProviderType& statisticsProvider, RegionGraph<ID>& rg) {
+
+		typedef typename RegionGraph<ID>::EdgeIdType EdgeIdType;
+
+		for (ID id1 = 1; id1 < _affinities.size(); ++id1) {
+			for (const auto& p: _affinities[id1]) {
+
+				// p.first is ID
+				// p.second is list of affiliated edges
+				EdgeIdType e = rg.addEdge(id1, p.first);
+				statisticsProvider.notifyNewEdge(e);
+
+				for (F affinity : p.second)
+					statisticsProvider.addAffinity(e, affinity);
+			}
+		}
+
+		WATERZ_LOG << "Region graph number of edges: " << rg.edges().size() << std::endl;
+	}
+
+private:
+
+	// list of affinities between pairs of regions
+	std::vector<std::map<ID, std::vector<F>>> _affinities;
+};
 
 /**
  * Extract the region graph from a segmentation. Edges are annotated with the 
  * maximum affinity between the regions.
  *
+ * Boundaries are found on run-length encoded rows, see visit_contacts(). 
+ * Affinities are passed to the statistics provider in the same order as 
+ * visiting the voxels in memory order would. The sizes of the regions are 
+ * passed with initNodeSizes(), unless the provider needs all voxels.
+ *
  * @param aff [in]
  *              The affinity graph to read the affinities from.
  * @param seg [in]
@@ -33,52 +268,134 @@ get_region_graph(
 
 	typedef typename AG::element F;
 	typedef typename V::element ID;
-	typedef RegionGraph<ID> RegionGraphType;
-	typedef typename RegionGraphType::EdgeIdType EdgeIdType;
 
-	std::ptrdiff_t zdim = aff.shape()[1];
-	std::ptrdiff_t ydim = aff.shape()[2];
-	std::ptrdiff_t xdim = aff.shape()[3];
+	region_contacts<ID, F> contacts(max_segid);
+	std::vector<std::size_t> sizes(StatisticsProviderType::NeedsVoxels ? 0 : max_segid + 1);
 
-	// list of affinities between pairs of regions
-	std::vector<std::map<ID, std::vector<F>>> affinities(max_segid+1);
+	visit_contacts(
+			aff,
+			seg,
+			[&](const segment_run<ID>& run, std::ptrdiff_t y, std::ptrdiff_t z) {
 
-	EdgeIdType e;
-	std::size_t p[3];
-	for (p[0] = 0; p[0] < zdim; ++p[0])
-		for (p[1] = 0; p[1] < ydim; ++p[1])
-			for (p[2] = 0; p[2] < xdim; ++p[2]) {
+				if (StatisticsProviderType::NeedsVoxels)
+					for (std::ptrdiff_t x = run.begin; x < run.end; ++x)
+						statisticsProvider.addVoxel(run.id, x, y, z);
+				else
+					sizes[run.id] += run.end - run.begin;
+			},
+			[&contacts](ID id1, ID id2, F affinity) {
 
-				ID id1 = seg[p[0]][p[1]][p[2]];
-				statisticsProvider.addVoxel(id1, p[2], p[1], p[0]);
+				contacts.add(id1, id2, affinity);
+			});
 
-				for (int d = 0; d < 3; d++) {
+	if (!StatisticsProviderType::NeedsVoxels)
+		statisticsProvider.initNodeSizes(sizes.data(), sizes.size());
 
-					if (p[d] == 0)
-						continue;
+	contacts.add_edges(statisticsProvider, rg);
+}
 
-					ID id2 = seg[p[0]-(d==0)][p[1]-(d==1)][p[2]-(d==2)];
+/**
+ * A watershed visitor that extracts the region graph during the final 
+ * labelling pass of the watershed, see watershed_region_graph().
+ */
+template <typename AG, typename V, typename StatisticsProviderType>
+class region_graph_visitor {
 
-					if (id1 != id2) {
+public:
 
-						auto mm = std::minmax(id1, id2);
-						affinities[mm.first][mm.second].push_back(aff[d][p[0]][p[1]][p[2]]);
-					}
-				}
-			}
+	typedef typename AG::element F;
+	typedef typename V::element  ID;
+
+	region_graph_visitor(
+			const AG& aff,
+			StatisticsProviderType& statisticsProvider,
+			RegionGraph<ID>& rg) :
+		_aff(aff),
+		_statisticsProvider(statisticsProvider),
+		_rg(rg) {
+
+		_strides = aff.strides();
+		_slice = aff.shape()[2]*aff.shape()[3];
+		_row = aff.shape()[3];
+	}
+
+	void begin(const counts_t<std::size_t>& counts) {
+
+		while (_rg.numNodes() < counts.size())
+			_rg.addNode();
+
+		// the watershed counted the voxels of each region already
+		if (!StatisticsProviderType::NeedsVoxels)
+			_statisticsProvider.initNodeSizes(counts.data(), counts.size());
+
+		_contacts.resize(counts.size() - 1);
+	}
+
+	inline void label(const ID* seg, std::ptrdiff_t idx, std::ptrdiff_t z, std::ptrdiff_t y, std::ptrdiff_t x) {
+
+		ID id = seg[idx];
+
+		if (StatisticsProviderType::NeedsVoxels)
+			_statisticsProvider.addVoxel(id, x, y, z);
+
+		// same order of affinities as in get_region_graph()
+		if (z > 0 && seg[idx - _slice] != id)
+			_contacts.add(id, seg[idx - _slice], affinity(0, z, y, x));
+		if (y > 0 && seg[idx - _row] != id)
+			_contacts.add(id, seg[idx - _row], affinity(1, z, y, x));
+		if (x > 0 && seg[idx - 1] != id)
+			_contacts.add(id, seg[idx - 1], affinity(2, z, y, x));
+	}
+
+	void add_edges() {
+
+		_contacts.add_edges(_statisticsProvider, _rg);
+	}
+
+private:
+
+	inline F affinity(int d, std::ptrdiff_t z, std::ptrdiff_t y, std::ptrdiff_t x) const {
+
+		return _aff.data()[d*_strides[0] + z*_strides[1] + y*_strides[2] + x*_strides[3]];
+	}
 
-	for (ID id1 = 1; id1 <= max_segid; ++id1) {
-		for (const auto& p: affinities[id1]) {
+	const AG& _aff;
+	StatisticsProviderType& _statisticsProvider;
+	RegionGraph<ID>& _rg;
+
+	region_contacts<ID, F> _contacts;
+
+	const typename AG::index* _strides;
+	std::ptrdiff_t _slice;
+	std::ptrdiff_t _row;
+};
+
+/**
+ * Perform a watershed segmentation and extract the region graph in its final 
+ * labelling pass, such that the affinities and the segmentation are streamed 
+ * only once more. Same as watershed() followed by get_region_graph(), 
+ * including the order of events passed to the statistics provider.
+ *
+ * @param statisticsProvider [in]
+ *              A statistics provider to update on-the-fly.
+ * @param region_graph [out]
+ *              An empty region graph, nodes are added for all found regions.
+ */
+template<typename AG, typename V, typename StatisticsProviderType>
+inline
+void
+watershed_region_graph(
+		const AG& aff,
+		typename AG::element low,
+		typename AG::element high,
+		V& seg,
+		counts_t<std::size_t>& counts,
+		StatisticsProviderType& statisticsProvider,
+		RegionGraph<typename V::element>& rg) {
 
-			// p.first is ID
-			// p.second is list of affiliated edges
-			EdgeIdType e = rg.addEdge(id1, p.first);
-			statisticsProvider.notifyNewEdge(e);
+	region_graph_visitor<AG, V, StatisticsProviderType> visitor(aff, statisticsProvider, rg);
 
-			for (F affinity : p.second)
-				statisticsProvider.addAffinity(e, affinity);
-        }
-    }
+	watershed(aff, low, high, seg, counts, visitor);
 
-	std::cout << "Region graph number of edges: " << rg.edges().size() << std::endl;
+	visitor.add_edges();
 }
@@ -0,0 +1,323 @@
+'''
+Content-addressed build cache for agglomerate modules of scoring functions that
+are not prebuilt.
+
+Modules are identified by a hash over everything that determines the compiled
+binary: the scoring function, the queue, the content of the C++ and Cython
+sources, the Cython version, and the Python ABI. Neither the Python executable
+nor the user are part of the key, such that a cache directory can be shared
+between users, virtual environments, and containers.
+
+The cache directory is given by the environment variable WATERZ_CACHE_DIR
+(default: ``$XDG_CACHE_HOME/waterz`` or ``~/.cache/waterz``). If
+WATERZ_CACHE_READONLY is set to a non-zero value, modules are never compiled,
+and a missing module is an error. This is meant for cluster jobs, which use a
+cache that was pre-warmed at image build time::
+
+    python -m waterz.cache --cache-dir /opt/waterz-cache \\
+        'OneMinus<MeanAffinity<RegionGraphType, ScoreValue>>' ...
+
+Modules are compiled in a temporary directory and moved into the cache with
+an atomic rename, i.e., concurrent builds of the same module do not block
+each other and readers never see partially written modules.
+'''
+
+import glob
+import hashlib
+import importlib.util
+import logging
+import os
+import shutil
+import sys
+import sysconfig
+import tempfile
+
+from . import prebuilt
+
+logger = logging.getLogger(__name__)
+
+# increase to invalidate all cached modules after changing the build below
+CACHE_VERSION = 1
+
+COMPILE_ARGS = ['-std=c++11', '-w', '-pthread']
+LINK_ARGS = ['-std=c++11', '-pthread']
+
+
+def cache_dir():
+    '''Get the cache directory from the environment.'''
+
+    directory = os.environ.get('WATERZ_CACHE_DIR')
+    if directory is None:
+        directory = os.path.join(
+            os.environ.get('XDG_CACHE_HOME', os.path.expanduser('~/.cache')),
+            'waterz')
+
+    return directory
+
+
+def is_readonly():
+    '''Whether the cache is configured to be read-only.'''
+
+    return os.environ.get('WATERZ_CACHE_READONLY', '0') != '0'
+
+
+def module_name(scoring_function, discretize_queue):
+    '''
+    Get the content-addressed name of the module for the given scoring
+    function and queue.
+    '''
+
+    import Cython
+
+    source_dir = os.path.dirname(os.path.abspath(__file__))
+    source_files = [
+        os.path.join(source_dir, 'agglomerate.pyx'),
+        os.path.join(source_dir, 'frontend_agglomerate.h'),
+        os.path.join(source_dir, 'frontend_agglomerate.cpp')
+    ]
+    source_files += glob.glob(os.path.join(source_dir, 'backend', '*.hpp'))
+
+    key = hashlib.sha256()
+
+    def add(value):
+        value = value.encode('utf-8') if isinstance(value, str) else value
+        key.update(str(len(value)).encode('utf-8') + b':' + value)
+
+    add(str(CACHE_VERSION))
+    add(prebuilt.scoring_function_header(prebuilt.normalize(scoring_function)))
+    add(prebuilt.queue_header(discretize_queue))
+    # sources are identified by their content and name relative to the package
+    for f in sorted(source_files):
+        add(os.path.relpath(f, source_dir))
+        with open(f, 'rb') as fh:
+            add(fh.read())
+    add(Cython.__version__)
+    add(' '.join(COMPILE_ARGS + LINK_ARGS))
+    # encodes the Python version, ABI, and platform
+    add(sysconfig.get_config_var('EXT_SUFFIX') or '')
+
+    return 'waterz_' + key.hexdigest()[:32]
+
+
+def module_path(name, directory=None):
+    '''Path of the compiled module with the given name in the cache.'''
+
+    if directory is None:
+        directory = cache_dir()
+
+    return os.path.join(directory, name + sysconfig.get_config_var('EXT_SUFFIX'))
+
+
+def load(
+        scoring_function,
+        discretize_queue,
+        force_rebuild=False,
+        directory=None,
+        readonly=None):
+    '''
+    Get the agglomerate module for the given scoring function and queue from
+    the cache. The module is compiled, if it is not in the cache yet (or
+    ``force_rebuild`` is set), unless the cache is read-only.
+
+    Parameters
+    ----------
+
+        directory: string (optional)
+
+            The cache directory. Defaults to cache_dir().
+
+        readonly: bool (optional)
+
+            Never compile modules. Defaults to is_readonly().
+    '''
+
+    if directory is None:
+        directory = cache_dir()
+    if readonly is None:
+        readonly = is_readonly()
+
+    name = module_name(scoring_function, discretize_queue)
+
+    if name in sys.modules and not force_rebuild:
+        return sys.modules[name]
+
+    path = module_path(name, directory)
+
+    if force_rebuild or not os.path.exists(path):
+
+        if readonly:
+            raise RuntimeError(
+                "Agglomerate module for scoring function %s and queue %d is "
+                "not in the read-only cache %s. Pre-warm the cache with "
+                "'python -m waterz.cache'." % (
+                    scoring_function, discretize_queue, directory))
+
+        build(scoring_function, discretize_queue, name, directory)
+
+    spec = importlib.util.spec_from_file_location(name, path)
+    module = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(module)
+    sys.modules[name] = module
+
+    return module
+
+
+def build(scoring_function, discretize_queue, name, directory):
+    '''
+    Compile the module with the given name in a temporary directory and
+    atomically move it into the cache directory.
+    '''
+
+    import numpy
+
+    from distutils.core import Distribution, Extension
+    from distutils.command.build_ext import build_ext
+    from distutils.sysconfig import get_config_vars, get_python_inc
+
+    from Cython.Build.Dependencies import cythonize
+
+    os.makedirs(directory, exist_ok=True)
+
+    logger.info("Compiling waterz in %s", directory)
+
+    source_dir = os.path.dirname(os.path.abspath(__file__))
+
+    # same file system as the cache directory, such that rename is atomic
+    build_dir = tempfile.mkdtemp(prefix='.' + name + '-', dir=directory)
+
+    try:
+
+        include_dirs = [
+            build_dir,
+            source_dir,
+            os.path.join(source_dir, 'backend'),
+            os.path.dirname(get_python_inc()),
+            numpy.get_include(),
+        ]
+
+        with open(os.path.join(build_dir, 'ScoringFunction.h'), 'w') as f:
+            f.write(prebuilt.scoring_function_header(scoring_function))
+        with open(os.path.join(build_dir, 'Queue.h'), 'w') as f:
+            f.write(prebuilt.queue_header(discretize_queue))
+
+        # cython requires that the pyx file has the same name as the module
+        pyx = os.path.join(build_dir, name + '.pyx')
+        cpp = os.path.join(build_dir, 'frontend_agglomerate.cpp')
+        shutil.copy(os.path.join(source_dir, 'agglomerate.pyx'), pyx)
+        shutil.copy(os.path.join(source_dir, 'frontend_agglomerate.cpp'), cpp)
+
+        # Remove the "-Wstrict-prototypes" compiler option, which isn't valid
+        # for C++.
+        cfg_vars = get_config_vars()
+        if "CFLAGS" in cfg_vars:
+            cfg_vars["CFLAGS"] = cfg_vars["CFLAGS"].replace("-Wstrict-prototypes", "")
+
+        extension = Extension(
+                name,
+                sources=[pyx, cpp],
+                include_dirs=include_dirs,
+                language='c++',
+                extra_link_args=LINK_ARGS,
+                extra_compile_args=COMPILE_ARGS
+        )
+        build_extension = build_ext(Distribution())
+        build_extension.finalize_options()
+        build_extension.extensions = cythonize([extension], quiet=True, nthreads=2)
+        build_extension.build_temp = build_dir
+        build_extension.build_lib = build_dir
+        build_extension.run()
+
+        # concurrent builds of the same module replace each other with
+        # identical content
+        os.rename(
+            module_path(name, build_dir),
+            module_path(name, directory))
+
+    finally:
+
+        shutil.rmtree(build_dir, ignore_errors=True)
+
+
+def is_prebuilt(scoring_function, discretize_queue):
+    '''Whether a prebuilt module is installed for the given variant.'''
+
+    name = prebuilt.module_name(scoring_function, discretize_queue)
+    if name is None:
+        return False
+
+    return importlib.util.find_spec('.' + name, __package__) is not None
+
+
+def prewarm(scoring_functions, discretize_queues=(0,), directory=None):
+    '''
+    Compile the agglomerate modules for all combinations of the given scoring
+    functions and queues into the cache, unless they are prebuilt or cached
+    already.
+
+    Returns a list of the paths of the cached modules.
+    '''
+
+    if directory is None:
+        directory = cache_dir()
+
+    paths = []
+    for scoring_function in scoring_functions:
+        for discretize_queue in discretize_queues:
+
+            if is_prebuilt(scoring_function, discretize_queue):
+                continue
+
+            name = module_name(scoring_function, discretize_queue)
+            path = module_path(name, directory)
+            if not os.path.exists(path):
+                build(scoring_function, discretize_queue, name, directory)
+            paths.append(path)
+
+    return paths
+
+
+def main(argv=None):
+
+    import argparse
+
+    parser = argparse.ArgumentParser(
+        prog='python -m waterz.cache',
+        description="Pre-warm the waterz build cache.")
+    parser.add_argument(
+        'scoring_functions',
+        nargs='*',
+        help="C++ scoring function types to compile")
+    parser.add_argument(
+        '-f', '--file',
+        help="read scoring functions from this file, one per line")
+    parser.add_argument(
+        '-q', '--discretize-queue',
+        type=int,
+        action='append',
+        help="discretize_queue values to compile for (default: 0)")
+    parser.add_argument(
+        '--cache-dir',
+        default=None,
+        help="cache directory (default: %s)" % cache_dir())
+    args = parser.parse_args(argv)
+
+    scoring_functions = list(args.scoring_functions)
+    if args.file:
+        with open(args.file) as f:
+            scoring_functions += [
+                line.strip()
+                for line in f
+                if line.strip() and not line.startswith('#')
+            ]
+
+    paths = prewarm(
+        scoring_functions,
+        args.discretize_queue or [0],
+        args.cache_dir)
+
+    for path in paths:
+        print(path)
+
+
+if __name__ == '__main__':
+    main()
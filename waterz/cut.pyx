@@ -0,0 +1,75 @@
+from libc.stdint cimport uint64_t
+import numpy as np
+cimport numpy as np
+
+def cut(tree, fragments, threshold, out=None):
+    '''
+    Get the segmentation for a threshold from a merge tree.
+
+    Parameters
+    ----------
+
+        tree: numpy structured array
+
+            The merge tree as returned by merge_tree().
+
+        fragments: numpy array, uint64
+
+            The fragments the merge tree was computed for.
+
+        threshold: float
+
+            The threshold to cut the tree at. The result is the same as
+            agglomerating the fragments until this threshold.
+
+        out: numpy array, uint64 (optional)
+
+            Where to store the segmentation. Can be the fragments array
+            itself. If not given, a new array is created.
+    '''
+
+    cdef np.ndarray[uint64_t, ndim=1] parents = np.ascontiguousarray(tree['parent'], dtype=np.uint64)
+    cdef np.ndarray[np.float32_t, ndim=1] scores = np.ascontiguousarray(tree['score'], dtype=np.float32)
+
+    fragments = np.ascontiguousarray(fragments, dtype=np.uint64)
+    if out is None:
+        out = np.empty_like(fragments)
+    elif out.shape != fragments.shape or out.dtype != np.uint64 or not out.flags['C_CONTIGUOUS']:
+        raise ValueError("out has to be a C_CONTIGUOUS uint64 array of the same shape as fragments")
+
+    if fragments.size > 0 and fragments.max() >= len(parents):
+        raise ValueError("fragments contain IDs that are not in the merge tree")
+
+    cdef np.ndarray[uint64_t, ndim=1] fragments_flat = fragments.reshape(-1)
+    cdef np.ndarray[uint64_t, ndim=1] out_flat = out.reshape(-1)
+
+    cdef size_t num_nodes = len(parents)
+    cdef size_t num_voxels = fragments.size
+    cdef float c_threshold = threshold
+    cdef uint64_t* parents_data = &parents[0] if num_nodes > 0 else NULL
+    cdef float* scores_data = &scores[0] if num_nodes > 0 else NULL
+    cdef uint64_t* fragments_data = &fragments_flat[0] if num_voxels > 0 else NULL
+    cdef uint64_t* out_data = &out_flat[0] if num_voxels > 0 else NULL
+
+    with nogil:
+        cut_merge_tree(
+            parents_data,
+            scores_data,
+            num_nodes,
+            c_threshold,
+            fragments_data,
+            out_data,
+            num_voxels)
+
+    return out
+
+cdef extern from "frontend_cut.h" nogil:
+
+    void cut_merge_tree(
+            const uint64_t* parents,
+            const float*    scores,
+            size_t          numNodes,
+            float           threshold,
+            const uint64_t* fragments_data,
+            uint64_t*       segmentation_data,
+            size_t          numVoxels)
@@ -1,7 +1,11 @@
 from libc.stdint cimport uint64_t
+from libcpp cimport bool
+import logging
 import numpy as np
 cimport numpy as np
 
+logger = logging.getLogger(__name__)
+
 def evaluate(
         np.ndarray[uint64_t, ndim=3] segmentation,
         np.ndarray[uint64_t, ndim=3] gt):
@@ -14,26 +18,33 @@ def evaluate(
     # the C++ part assumes contiguous memory, make sure we have it (and do 
     # nothing, if we do)
     if not segmentation.flags['C_CONTIGUOUS']:
-        print("Creating memory-contiguous segmentation arrray (avoid this by passing C_CONTIGUOUS arrays)")
+        logger.info("Creating memory-contiguous segmentation arrray (avoid this by passing C_CONTIGUOUS arrays)")
         segmentation = np.ascontiguousarray(segmentation)
     if gt is not None and not gt.flags['C_CONTIGUOUS']:
-        print("Creating memory-contiguous ground-truth arrray (avoid this by passing C_CONTIGUOUS arrays)")
+        logger.info("Creating memory-contiguous ground-truth arrray (avoid this by passing C_CONTIGUOUS arrays)")
         gt = np.ascontiguousarray(gt)
 
     cdef uint64_t* segmentation_data
     cdef uint64_t* gt_data
+    cdef size_t width = shape[0]
+    cdef size_t height = shape[1]
+    cdef size_t depth = shape[2]
+    cdef Metrics scores
+
+    setLogging(logger.isEnabledFor(logging.DEBUG))
 
     segmentation_data = &segmentation[0, 0, 0]
     gt_data = &gt[0, 0, 0]
 
-    scores = compare_arrays(
-        shape[0], shape[1], shape[2],
-        gt_data,
-        segmentation_data)
+    with nogil:
+        scores = compare_arrays(
+            width, height, depth,
+            gt_data,
+            segmentation_data)
 
     return scores
 
-cdef extern from "frontend_evaluate.h":
+cdef extern from "frontend_evaluate.h" nogil:
 
     struct Metrics:
         double voi_split
@@ -47,3 +58,5 @@ cdef extern from "frontend_evaluate.h":
             size_t          depth,
             const uint64_t* gt_data,
             const uint64_t* segmentation_data);
+
+    void setLogging(bool enabled)
@@ -1,17 +1,133 @@
 #include <memory>
 
 #include <iostream>
+#include <fstream>
 #include <algorithm>
+#include <cstdio>
+#include <typeinfo>
 #include <vector>
 
 #include "frontend_agglomerate.h"
-#include "evaluate.hpp"
 #include "backend/MergeFunctions.hpp"
 #include "backend/basic_watershed.hpp"
 #include "backend/region_graph.hpp"
+#include "backend/merge_small_fragments.hpp"
 
-std::map<int, WaterzContext*> WaterzContext::_contexts;
-int WaterzContext::_nextId = 0;
+ContextRegistry<WaterzContext> WaterzContext::_contexts;
+
+// 'WATERZST' in little endian, identifies files written by saveState()
+const uint64_t StateFileMagic = 0x54535a5245544157ull;
+
+// increase when changing the layout of state files
+const uint64_t StateFileVersion = 3;
+
+StageTiming
+stageTiming(const StageTimer& timer) {
+
+	StageTiming timing;
+	timing.wall = timer.wallSeconds();
+	timing.cpu  = timer.cpuSeconds();
+
+	return timing;
+}
+
+void
+setMetrics(WaterzState& state, const ContingencyTableType& contingencyTable) {
+
+	auto m = contingencyTable.metrics();
+
+	state.metrics.rand_split = std::get<0>(m);
+	state.metrics.rand_merge = std::get<1>(m);
+	state.metrics.voi_split  = std::get<2>(m);
+	state.metrics.voi_merge  = std::get<3>(m);
+}
+
+/**
+ * Identifies the types that determine the layout of a state file.
+ */
+std::string
+stateFileType() {
+
+	return
+			std::string(typeid(ScoringFunctionType).name()) + " " +
+			typeid(RegionMergingType).name();
+}
+
+void
+writeStateHeader(
+		BinaryWriter& writer,
+		const std::string& info,
+		const std::vector<uint64_t>& shape) {
+
+	writer.write(StateFileMagic);
+	writer.write(StateFileVersion);
+	writer.write(info);
+	writer.write(stateFileType());
+	writer.write(shape);
+}
+
+std::vector<std::size_t>
+readStateHeader(BinaryReader& reader, const std::string& path) {
+
+	uint64_t magic;
+	uint64_t version;
+	std::string info;
+	std::string type;
+	std::vector<uint64_t> shape;
+
+	reader.read(magic);
+	if (magic != StateFileMagic)
+		throw std::runtime_error(path + " is not a waterz state file");
+
+	reader.read(version);
+	if (version != StateFileVersion)
+		throw std::runtime_error(
+				path + " has version " + std::to_string(version) +
+				", expected " + std::to_string(StateFileVersion));
+
+	reader.read(info);
+	reader.read(type);
+	if (type != stateFileType())
+		throw std::runtime_error(
+				path + " was written for a different scoring function or queue");
+
+	reader.read(shape);
+	if (shape.size() != 3)
+		throw std::runtime_error(path + " is corrupt");
+
+	return std::vector<std::size_t>(shape.begin(), shape.end());
+}
+
+/**
+ * Create a new context for the given region graph, statistics, and 
+ * segmentation, and store its ID in state.
+ */
+WaterzContext::Handle
+createContext(
+		WaterzState& state,
+		std::shared_ptr<RegionGraphType> regionGraph,
+		std::shared_ptr<StatisticsProviderType> statisticsProvider,
+		volume_ref_ptr<SegID> segmentation) {
+
+	std::shared_ptr<ScoringFunctionType> scoringFunction(
+			new ScoringFunctionType(*regionGraph, *statisticsProvider)
+	);
+
+	std::shared_ptr<RegionMergingType> regionMerging(
+			new RegionMergingType(*regionGraph)
+	);
+
+	WaterzContext::Handle context = WaterzContext::createNew();
+	context->regionGraph        = regionGraph;
+	context->regionMerging      = regionMerging;
+	context->scoringFunction    = scoringFunction;
+	context->statisticsProvider = statisticsProvider;
+	context->segmentation       = segmentation;
+
+	state.context = context->id;
+
+	return context;
+}
 
 WaterzState
 initialize(
@@ -23,10 +139,20 @@ initialize(
 		const GtID*     ground_truth_data,
 		AffValue        affThresholdLow,
 		AffValue        affThresholdHigh,
-		bool            findFragments) {
+		bool            findFragments,
+		const std::string& scoringExpression,
+		ScoreValue      preMergeThreshold,
+		std::size_t     fragmentSizeThreshold,
+		AffValue        fragmentAffThreshold,
+		bool            fragmentsInXy) {
 
 	std::size_t num_voxels = width*height*depth;
 
+	// parse the scoring expression first, to fail early on syntax errors
+	ScoringExpression expression;
+	if (!scoringExpression.empty())
+		expression = ScoringExpression(scoringExpression);
+
 	// wrap affinities (no copy)
 	affinity_graph_ref<AffValue> affinities(
 			affinity_data,
@@ -41,17 +167,70 @@ initialize(
 			)
 	);
 
+	WaterzState initial_state = WaterzState();
+
 	counts_t<std::size_t> sizes;
 
-	if (findFragments) {
+	// nodes are added once the fragments are known
+	std::shared_ptr<RegionGraphType> regionGraph(
+			new RegionGraphType()
+	);
 
-		std::cout << "performing initial watershed segmentation..." << std::endl;
+	WATERZ_LOG << "creating statistics provider" << std::endl;
+	std::shared_ptr<StatisticsProviderType> statisticsProvider(
+			new StatisticsProviderType(*regionGraph)
+	);
+	configureScoringExpression(*statisticsProvider, expression);
+
+	StageTimer fragmentsTimer;
+
+	// the region graph is extracted in the final pass of the 3D watershed, 
+	// unless fragments are merged afterwards
+	bool fusedRegionGraph = findFragments && !fragmentsInXy && fragmentSizeThreshold == 0;
+
+	if (fusedRegionGraph) {
+
+		WATERZ_LOG << "performing initial watershed segmentation and extracting region graph..." << std::endl;
+
+		watershed_region_graph(
+				affinities,
+				affThresholdLow,
+				affThresholdHigh,
+				*segmentation,
+				sizes,
+				*statisticsProvider,
+				*regionGraph);
+
+	} else if (findFragments) {
+
+		if (fragmentsInXy) {
 
-		watershed(affinities, affThresholdLow, affThresholdHigh, *segmentation, sizes);
+			WATERZ_LOG << "performing initial watershed segmentation in xy..." << std::endl;
+
+			watershed_2d(affinities, affThresholdLow, affThresholdHigh, *segmentation, sizes);
+
+		} else {
+
+			WATERZ_LOG << "performing initial watershed segmentation..." << std::endl;
+
+			watershed(affinities, affThresholdLow, affThresholdHigh, *segmentation, sizes);
+		}
+
+		if (fragmentSizeThreshold > 0) {
+
+			WATERZ_LOG << "merging fragments smaller than " << fragmentSizeThreshold << "..." << std::endl;
+
+			merge_small_fragments(
+					affinities,
+					*segmentation,
+					sizes,
+					fragmentSizeThreshold,
+					fragmentAffThreshold);
+		}
 
 	} else {
 
-		std::cout << "counting regions and sizes..." << std::endl;
+		WATERZ_LOG << "counting regions and sizes..." << std::endl;
 
 		std::size_t maxId = *std::max_element(segmentation_data, segmentation_data + num_voxels);
 		sizes.resize(maxId + 1);
@@ -59,58 +238,129 @@ initialize(
 			sizes[segmentation_data[i]]++;
 	}
 
-	std::size_t numNodes = sizes.size();
-	std::cout << "creating region graph for " << numNodes << " nodes" << std::endl;
+	initial_state.timings.fragments = stageTiming(fragmentsTimer);
 
-	std::shared_ptr<RegionGraphType> regionGraph(
-			new RegionGraphType(numNodes)
-	);
+	StageTimer regionGraphTimer;
 
-	std::cout << "creating statistics provider" << std::endl;
-	std::shared_ptr<StatisticsProviderType> statisticsProvider(
-			new StatisticsProviderType(*regionGraph)
-	);
+	if (!fusedRegionGraph) {
 
-	std::cout << "extracting region graph..." << std::endl;
+		std::size_t numNodes = sizes.size();
+		WATERZ_LOG << "creating region graph for " << numNodes << " nodes" << std::endl;
 
-	get_region_graph(
-			affinities,
-			*segmentation,
-			numNodes - 1,
-			*statisticsProvider,
-			*regionGraph);
+		while (regionGraph->numNodes() < numNodes)
+			regionGraph->addNode();
 
-	std::shared_ptr<ScoringFunctionType> scoringFunction(
-			new ScoringFunctionType(*regionGraph, *statisticsProvider)
-	);
+		WATERZ_LOG << "extracting region graph..." << std::endl;
 
-	std::shared_ptr<RegionMergingType> regionMerging(
-			new RegionMergingType(*regionGraph)
-	);
+		get_region_graph(
+				affinities,
+				*segmentation,
+				numNodes - 1,
+				*statisticsProvider,
+				*regionGraph);
+	}
 
-	WaterzContext* context = WaterzContext::createNew();
-	context->regionGraph        = regionGraph;
-	context->regionMerging      = regionMerging;
-	context->scoringFunction    = scoringFunction;
-	context->statisticsProvider = statisticsProvider;
-	context->segmentation       = segmentation;
+	if (preMergeThreshold > std::numeric_limits<ScoreValue>::lowest()) {
 
-	WaterzState initial_state;
-	initial_state.context = context->id;
+		WATERZ_LOG << "pre-merging edges below " << preMergeThreshold << std::endl;
+
+		ScoringFunctionType scoringFunction(*regionGraph, *statisticsProvider);
+		std::vector<SegID> roots;
+
+		if (preMerge(*regionGraph, scoringFunction, *statisticsProvider, preMergeThreshold, roots) > 0)
+			for (std::size_t i = 0; i < num_voxels; i++)
+				segmentation_data[i] = roots[segmentation_data[i]];
+	}
+
+	initial_state.timings.region_graph = stageTiming(regionGraphTimer);
+
+	WaterzContext::Handle context = createContext(
+			initial_state,
+			regionGraph,
+			statisticsProvider,
+			segmentation);
 
 	if (ground_truth_data != NULL) {
 
+		WATERZ_LOG << "computing overlap with ground-truth" << std::endl;
+
+		StageTimer groundTruthTimer;
+
 		// wrap ground-truth (no copy)
-		volume_const_ref_ptr<GtID> groundtruth(
-				new volume_const_ref<GtID>(
-						ground_truth_data,
-						boost::extents[width][height][depth]
-				)
+		volume_const_ref<GtID> groundtruth(
+				ground_truth_data,
+				boost::extents[width][height][depth]
 		);
 
-		context->groundtruth = groundtruth;
+		context->contingencyTable = std::make_shared<ContingencyTableType>(
+				*segmentation,
+				groundtruth);
+
+		setMetrics(initial_state, *context->contingencyTable);
+
+		initial_state.timings.ground_truth = stageTiming(groundTruthTimer);
 	}
 
+	initial_state.counters.allocated_bytes = allocatedBytes();
+
+	return initial_state;
+}
+
+WaterzState
+initializeFromRegionGraph(
+		std::size_t                numNodes,
+		std::size_t                numEdges,
+		const SegID*               edges,
+		const StatisticsSeedsType& seeds,
+		SegID*                     labels_data,
+		const std::string&         scoringExpression) {
+
+	ScoringExpression expression;
+	if (!scoringExpression.empty())
+		expression = ScoringExpression(scoringExpression);
+
+	WaterzState initial_state = WaterzState();
+
+	// the segmentation of this context is a lookup table from nodes to 
+	// segments, which starts with each node in its own segment
+	volume_ref_ptr<SegID> labels(
+			new volume_ref<SegID>(
+					labels_data,
+					boost::extents[1][1][numNodes]
+			)
+	);
+	for (std::size_t i = 0; i < numNodes; i++)
+		labels_data[i] = i;
+
+	WATERZ_LOG << "creating region graph with " << numNodes << " nodes and " << numEdges << " edges" << std::endl;
+
+	StageTimer regionGraphTimer;
+
+	// add all edges before creating the statistics provider, such that its 
+	// maps are allocated only once
+	std::shared_ptr<RegionGraphType> regionGraph(
+			new RegionGraphType(numNodes)
+	);
+	regionGraph->addEdges(edges, numEdges);
+
+	WATERZ_LOG << "seeding statistics provider" << std::endl;
+
+	std::shared_ptr<StatisticsProviderType> statisticsProvider(
+			new StatisticsProviderType(*regionGraph)
+	);
+	configureScoringExpression(*statisticsProvider, expression);
+
+	StatisticsSeedsType sized = seeds;
+	sized.numNodes = numNodes;
+	sized.numEdges = numEdges;
+	statisticsProvider->seed(sized);
+
+	initial_state.timings.region_graph = stageTiming(regionGraphTimer);
+
+	createContext(initial_state, regionGraph, statisticsProvider, labels);
+
+	initial_state.counters.allocated_bytes = allocatedBytes();
+
 	return initial_state;
 }
 
@@ -119,51 +369,410 @@ mergeUntil(
 		WaterzState& state,
 		float        threshold) {
 
-	WaterzContext* context = WaterzContext::get(state.context);
+	WaterzContext::Handle context = WaterzContext::get(state.context);
 
-	std::cout << "merging until threshold " << threshold << std::endl;
+	if (!context) {
+
+		std::cerr << "context " << state.context << " does not exist" << std::endl;
+		return std::vector<Merge>();
+	}
+
+	std::lock_guard<std::mutex> lock(context->mutex);
+
+	WATERZ_LOG << "merging until threshold " << threshold << std::endl;
+
+	state.counters = Counters();
+	state.timings.merge = StageTiming();
+	state.timings.extract_segmentation = StageTiming();
 
 	std::vector<Merge>  mergeHistory;
 	MergeHistoryVisitor mergeHistoryVisitor(mergeHistory);
 
-	std::size_t merged = context->regionMerging->mergeUntil(
-			*context->scoringFunction,
-			*context->statisticsProvider,
-			threshold,
-			mergeHistoryVisitor);
+	// update the overlap with the ground-truth (if given) with each merge
+	ContingencyTableVisitor contingencyTableVisitor(context->contingencyTable.get());
+
+	CountingVisitor countingVisitor(*context->regionMerging, state.counters);
+	EventLogVisitor eventLogVisitor(context->eventLog.get());
+
+	CompoundVisitor<MergeHistoryVisitor, ContingencyTableVisitor> historyVisitor(
+			mergeHistoryVisitor,
+			contingencyTableVisitor);
+	CompoundVisitor<CountingVisitor, EventLogVisitor> profilingVisitor(
+			countingVisitor,
+			eventLogVisitor);
+	CompoundVisitor<decltype(historyVisitor), decltype(profilingVisitor)> visitor(
+			historyVisitor,
+			profilingVisitor);
+
+	StageTimer mergeTimer;
+
+	std::size_t merged;
+	if (context->mergeBatchSize > 0)
+		merged = context->regionMerging->mergeUntilInBatches(
+				*context->scoringFunction,
+				*context->statisticsProvider,
+				threshold,
+				visitor,
+				context->mergeBatchSize);
+	else
+		merged = context->regionMerging->mergeUntil(
+				*context->scoringFunction,
+				*context->statisticsProvider,
+				threshold,
+				visitor);
+
+	state.timings.merge = stageTiming(mergeTimer);
 
 	if (merged) {
 
-		std::cout << "extracting segmentation" << std::endl;
+		WATERZ_LOG << "extracting segmentation" << std::endl;
+
+		StageTimer extractTimer;
 
 		context->regionMerging->extractSegmentation(*context->segmentation);
+
+		state.timings.extract_segmentation = stageTiming(extractTimer);
 	}
 
-	if (context->groundtruth) {
+	if (context->contingencyTable)
+		setMetrics(state, *context->contingencyTable);
+
+	state.counters.peak_queue_size = std::max(
+			state.counters.peak_queue_size,
+			context->regionMerging->queueSize());
+	state.counters.allocated_bytes = allocatedBytes();
+	if (context->eventLog)
+		state.counters.dropped_events = context->eventLog->dropped();
+
+	return mergeHistory;
+}
 
-		std::cout << "evaluating current segmentation against ground-truth" << std::endl;
+std::vector<MergeCurvePoint>
+getMergeCurve(
+		WaterzState& state,
+		float        threshold) {
 
-		auto m = compare_volumes(*context->groundtruth, *context->segmentation);
+	WaterzContext::Handle context = WaterzContext::get(state.context);
 
-		state.metrics.rand_split = std::get<0>(m);
-		state.metrics.rand_merge = std::get<1>(m);
-		state.metrics.voi_split  = std::get<2>(m);
-		state.metrics.voi_merge  = std::get<3>(m);
+	std::vector<MergeCurvePoint> curve;
+
+	if (!context) {
+
+		std::cerr << "context " << state.context << " does not exist" << std::endl;
+		return curve;
 	}
 
-	return mergeHistory;
+	std::lock_guard<std::mutex> lock(context->mutex);
+
+	if (!context->contingencyTable) {
+
+		std::cerr << "merge curve requested, but no ground-truth was given" << std::endl;
+		return curve;
+	}
+
+	WATERZ_LOG << "recording merge curve until threshold " << threshold << std::endl;
+
+	state.counters = Counters();
+	state.timings.merge = StageTiming();
+	state.timings.extract_segmentation = StageTiming();
+
+	// the contingency table has to be updated before the curve visitor reads 
+	// it
+	ContingencyTableVisitor contingencyTableVisitor(context->contingencyTable.get());
+	MergeCurveVisitor       mergeCurveVisitor(*context->contingencyTable, curve);
+
+	CountingVisitor countingVisitor(*context->regionMerging, state.counters);
+	EventLogVisitor eventLogVisitor(context->eventLog.get());
+
+	CompoundVisitor<ContingencyTableVisitor, MergeCurveVisitor> curveVisitor(
+			contingencyTableVisitor,
+			mergeCurveVisitor);
+	CompoundVisitor<CountingVisitor, EventLogVisitor> profilingVisitor(
+			countingVisitor,
+			eventLogVisitor);
+	CompoundVisitor<decltype(curveVisitor), decltype(profilingVisitor)> visitor(
+			curveVisitor,
+			profilingVisitor);
+
+	StageTimer mergeTimer;
+
+	context->regionMerging->mergeUntil(
+			*context->scoringFunction,
+			*context->statisticsProvider,
+			threshold,
+			visitor);
+
+	state.timings.merge = stageTiming(mergeTimer);
+
+	setMetrics(state, *context->contingencyTable);
+
+	state.counters.peak_queue_size = std::max(
+			state.counters.peak_queue_size,
+			context->regionMerging->queueSize());
+	state.counters.allocated_bytes = allocatedBytes();
+	if (context->eventLog)
+		state.counters.dropped_events = context->eventLog->dropped();
+
+	return curve;
 }
 
 std::vector<ScoredEdge>
 getRegionGraph(WaterzState& state) {
 
-	WaterzContext* context = WaterzContext::get(state.context);
+	WaterzContext::Handle context = WaterzContext::get(state.context);
+
+	if (!context) {
+
+		std::cerr << "context " << state.context << " does not exist" << std::endl;
+		return std::vector<ScoredEdge>();
+	}
+
+	std::lock_guard<std::mutex> lock(context->mutex);
+
 	std::shared_ptr<RegionMergingType> regionMerging = context->regionMerging;
 	std::shared_ptr<ScoringFunctionType> scoringFunction = context->scoringFunction;
 
 	return regionMerging->extractRegionGraph<ScoredEdge>(*scoringFunction);
 }
 
+std::vector<MergeTreeNode>
+getMergeTree(WaterzState& state) {
+
+	WaterzContext::Handle context = WaterzContext::get(state.context);
+
+	std::vector<MergeTreeNode> nodes;
+
+	if (!context) {
+
+		std::cerr << "context " << state.context << " does not exist" << std::endl;
+		return nodes;
+	}
+
+	std::lock_guard<std::mutex> lock(context->mutex);
+
+	WATERZ_LOG << "computing merge tree" << std::endl;
+
+	state.counters = Counters();
+	state.timings.merge = StageTiming();
+	state.timings.extract_segmentation = StageTiming();
+
+	MergeTree<SegID, ScoreValue> mergeTree(context->regionGraph->numNodes());
+
+	MergeTreeVisitor mergeTreeVisitor(mergeTree);
+	CountingVisitor countingVisitor(*context->regionMerging, state.counters);
+
+	CompoundVisitor<MergeTreeVisitor, CountingVisitor> visitor(
+			mergeTreeVisitor,
+			countingVisitor);
+
+	StageTimer mergeTimer;
+
+	context->regionMerging->mergeUntil(
+			*context->scoringFunction,
+			*context->statisticsProvider,
+			std::numeric_limits<ScoreValue>::infinity(),
+			visitor);
+
+	state.timings.merge = stageTiming(mergeTimer);
+
+	nodes.resize(mergeTree.size());
+	for (std::size_t i = 0; i < mergeTree.size(); i++) {
+
+		nodes[i].parent = mergeTree.parents()[i];
+		nodes[i].score  = mergeTree.levels()[i];
+	}
+
+	state.counters.allocated_bytes = allocatedBytes();
+
+	return nodes;
+}
+
+void
+setEventLog(
+		WaterzState& state,
+		std::size_t  capacity,
+		unsigned int sampling) {
+
+	WaterzContext::Handle context = WaterzContext::get(state.context);
+
+	if (!context) {
+
+		std::cerr << "context " << state.context << " does not exist" << std::endl;
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(context->mutex);
+
+	if (capacity == 0)
+		context->eventLog.reset();
+	else
+		context->eventLog = std::make_shared<EventLog>(capacity, sampling);
+}
+
+void
+setMergeBatchSize(
+		WaterzState& state,
+		std::size_t  batchSize) {
+
+	WaterzContext::Handle context = WaterzContext::get(state.context);
+
+	if (!context) {
+
+		std::cerr << "context " << state.context << " does not exist" << std::endl;
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(context->mutex);
+
+	context->mergeBatchSize = batchSize;
+}
+
+std::vector<Event>
+getEventLog(WaterzState& state) {
+
+	WaterzContext::Handle context = WaterzContext::get(state.context);
+
+	if (!context) {
+
+		std::cerr << "context " << state.context << " does not exist" << std::endl;
+		return std::vector<Event>();
+	}
+
+	std::lock_guard<std::mutex> lock(context->mutex);
+
+	if (!context->eventLog)
+		return std::vector<Event>();
+
+	return context->eventLog->drain();
+}
+
+void
+saveState(
+		WaterzState&       state,
+		const std::string& path,
+		const std::string& info) {
+
+	WaterzContext::Handle context = WaterzContext::get(state.context);
+
+	if (!context)
+		throw std::invalid_argument("context " + std::to_string(state.context) + " does not exist");
+
+	std::lock_guard<std::mutex> lock(context->mutex);
+
+	WATERZ_LOG << "saving state to " << path << std::endl;
+
+	const volume_ref<SegID>& segmentation = *context->segmentation;
+
+	std::vector<uint64_t> shape(segmentation.shape(), segmentation.shape() + 3);
+
+	// write to a temporary file first, such that readers never see a 
+	// partially written state
+	std::string tmpPath = path + ".tmp";
+
+	try {
+
+		std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+		if (!out)
+			throw std::runtime_error("can not open " + tmpPath + " for writing");
+
+		BinaryWriter writer(out);
+
+		writeStateHeader(writer, info, shape);
+		writer.writeArray(segmentation.data(), segmentation.num_elements());
+		context->regionGraph->save(writer);
+		context->statisticsProvider->save(writer);
+		context->regionMerging->save(writer);
+
+		out.close();
+		if (!out)
+			throw std::runtime_error("failed to write " + tmpPath);
+
+	} catch (...) {
+
+		std::remove(tmpPath.c_str());
+		throw;
+	}
+
+	if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+
+		std::remove(tmpPath.c_str());
+		throw std::runtime_error("failed to move " + tmpPath + " to " + path);
+	}
+}
+
+std::vector<std::size_t>
+getSavedShape(const std::string& path) {
+
+	std::ifstream in(path, std::ios::binary);
+	if (!in)
+		throw std::runtime_error("can not open " + path);
+
+	BinaryReader reader(in);
+
+	return readStateHeader(reader, path);
+}
+
+WaterzState
+resumeState(
+		const std::string& path,
+		SegID*             segmentation_data) {
+
+	std::ifstream in(path, std::ios::binary);
+	if (!in)
+		throw std::runtime_error("can not open " + path);
+
+	WATERZ_LOG << "resuming from " << path << std::endl;
+
+	BinaryReader reader(in);
+
+	std::vector<std::size_t> shape = readStateHeader(reader, path);
+
+	WaterzState resumed_state = WaterzState();
+
+	// loading replaces the fragments and region graph stages
+	StageTimer loadTimer;
+
+	volume_ref_ptr<SegID> segmentation(
+			new volume_ref<SegID>(
+					segmentation_data,
+					boost::extents[shape[0]][shape[1]][shape[2]]
+			)
+	);
+	reader.readArray(segmentation_data, segmentation->num_elements());
+
+	// the region graph has to be loaded before node and edge maps are 
+	// created for it
+	std::shared_ptr<RegionGraphType> regionGraph(new RegionGraphType());
+	regionGraph->load(reader);
+
+	std::shared_ptr<StatisticsProviderType> statisticsProvider(
+			new StatisticsProviderType(*regionGraph)
+	);
+	statisticsProvider->load(reader);
+
+	WaterzContext::Handle context = createContext(
+			resumed_state,
+			regionGraph,
+			statisticsProvider,
+			segmentation);
+
+	// the caller can not free a context it did not get
+	try {
+
+		context->regionMerging->load(reader);
+
+	} catch (...) {
+
+		WaterzContext::free(resumed_state.context);
+		throw;
+	}
+
+	resumed_state.timings.region_graph = stageTiming(loadTimer);
+	resumed_state.counters.allocated_bytes = allocatedBytes();
+
+	return resumed_state;
+}
+
 void
 free(WaterzState& state) {
 
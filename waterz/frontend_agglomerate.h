@@ -2,8 +2,17 @@
 #define C_FRONTEND_H
 
 #include <vector>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <stdexcept>
+#include <type_traits>
 
 #include "backend/IterativeRegionMerging.hpp"
+#include "backend/SingleLinkageMerging.hpp"
+#include "backend/PreMerging.hpp"
 #include "backend/MergeFunctions.hpp"
 #include "backend/Operators.hpp"
 #include "backend/types.hpp"
@@ -11,20 +20,38 @@
 #include "backend/PriorityQueue.hpp"
 #include "backend/HistogramQuantileProvider.hpp"
 #include "backend/VectorQuantileProvider.hpp"
-#include "evaluate.hpp"
+#include "backend/ScoringExpression.hpp"
+#include "backend/ContingencyTable.hpp"
+#include "backend/ContextRegistry.hpp"
+#include "backend/Instrumentation.hpp"
+#include "backend/Logging.hpp"
+#include "backend/RingBuffer.hpp"
+#include "backend/MergeTree.hpp"
+#include "backend/Serialization.hpp"
+#include "backend/StatisticsSeeds.hpp"
 
 typedef uint64_t SegID;
 typedef uint32_t GtID;
 typedef float AffValue;
 typedef float ScoreValue;
 typedef RegionGraph<SegID> RegionGraphType;
+typedef ContingencyTable<SegID, GtID> ContingencyTableType;
 
 // to be created by __init__.py
 #include <ScoringFunction.h>
 #include <Queue.h>
 
 typedef typename ScoringFunctionType::StatisticsProviderType StatisticsProviderType;
-typedef IterativeRegionMerging<SegID, ScoreValue, QueueType> RegionMergingType;
+
+// single-linkage scoring functions don't need a queue, see 
+// SingleLinkageMerging
+typedef typename std::conditional<
+		IsSingleLinkage<ScoringFunctionType>::value,
+		SingleLinkageMerging<SegID, ScoreValue>,
+		IterativeRegionMerging<SegID, ScoreValue, QueueType>>::type
+	RegionMergingType;
+
+typedef StatisticsSeeds<ScoreValue> StatisticsSeedsType;
 
 struct Metrics {
 
@@ -44,6 +71,8 @@ struct Merge {
 
 struct ScoredEdge {
 
+	ScoredEdge() {}
+
 	ScoredEdge(SegID u_, SegID v_, ScoreValue score_) :
 		u(u_),
 		v(v_),
@@ -54,64 +83,250 @@ struct ScoredEdge {
 	ScoreValue score;
 };
 
-struct WaterzState {
+/**
+ * A node of the merge tree, see MergeTree.hpp.
+ */
+struct MergeTreeNode {
 
-	int     context;
+	SegID      parent;
+	ScoreValue score;
+};
+
+struct MergeCurvePoint {
+
+	ScoreValue score;
 	Metrics metrics;
 };
 
-class WaterzContext {
+struct StageTiming {
+
+	double wall;
+	double cpu;
+};
+
+/**
+ * Wall and CPU time in seconds of each stage. The merge and 
+ * extract_segmentation times are for the last call to mergeUntil() or 
+ * getMergeCurve().
+ */
+struct Timings {
+
+	StageTiming fragments;
+	StageTiming region_graph;
+	StageTiming ground_truth;
+	StageTiming merge;
+	StageTiming extract_segmentation;
+};
+
+/**
+ * Counters of the last call to mergeUntil() or getMergeCurve().
+ */
+struct Counters {
+
+	// edges taken from the queue
+	std::size_t pops;
+	// edges that had to be re-scored
+	std::size_t stale;
+	// edges that were discarded, since they got deleted by a previous merge
+	std::size_t deleted;
+	std::size_t merges;
+	std::size_t peak_queue_size;
+	// bytes allocated by the process after the call (0 if not supported)
+	std::size_t allocated_bytes;
+	// events that were overwritten in the event log
+	std::size_t dropped_events;
+};
+
+enum EventType {
+
+	DeletedEdgeEvent = 0,
+	StaleEdgeEvent   = 1,
+	MergeEvent       = 2,
+	PutBackEdgeEvent = 3
+};
+
+/**
+ * An event of the merge loop. Each event corresponds to one edge taken from 
+ * the queue. Edges that are put back into the queue unchanged (when merging 
+ * in batches) are recorded when they are put back, with the number of pops 
+ * and timestamp of that moment.
+ */
+struct Event {
+
+	// nanoseconds since the event log was created
+	uint64_t   timestamp;
+	// number of pops since the event log was created, including this one
+	uint64_t   pop;
+	uint64_t   edge;
+	// for merges, b got merged into a
+	SegID      a;
+	SegID      b;
+	// score of the edge when it was popped, and the new score of stale edges
+	ScoreValue old_score;
+	ScoreValue new_score;
+	uint8_t    type;
+};
+
+struct WaterzState {
+
+	int      context;
+	Metrics  metrics;
+	Timings  timings;
+	Counters counters;
+};
+
+/**
+ * Records the events of the merge loop in a ring buffer. To limit the 
+ * overhead, only edges whose hash is divisible by the sampling rate are 
+ * recorded. Sampling by edge keeps the complete history of the sampled 
+ * edges.
+ */
+class EventLog {
 
 public:
 
-	static WaterzContext* createNew() {
+	EventLog(std::size_t capacity, unsigned int sampling) :
+		_events(capacity),
+		_sampling(std::max(1u, sampling)),
+		_pops(0),
+		_start(std::chrono::steady_clock::now()) {}
 
-		WaterzContext* context = new WaterzContext();
-		context->id = _nextId;
-		_nextId++;
-		_contexts.insert(std::make_pair(context->id, context));
+	inline bool sampled(RegionGraphType::EdgeIdType e) const {
 
-		return context;
+		// Fibonacci hashing, such that neighboring edge IDs are not sampled 
+		// alike
+		return ((uint64_t(e)*0x9E3779B97F4A7C15ull) >> 32) % _sampling == 0;
 	}
 
-	static WaterzContext* get(int id) {
+	inline void record(
+			EventType type,
+			RegionGraphType::EdgeIdType e,
+			ScoreValue oldScore,
+			ScoreValue newScore,
+			SegID a = 0,
+			SegID b = 0) {
+
+		Event event;
+		event.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - _start).count();
+		event.pop       = _pops;
+		event.edge      = e;
+		event.a         = a;
+		event.b         = b;
+		event.old_score = oldScore;
+		event.new_score = newScore;
+		event.type      = type;
+
+		_events.push(event);
+	}
 
-		if (!_contexts.count(id))
-			return NULL;
+	inline void countPop() { _pops++; }
 
-		return _contexts.at(id);
+	std::size_t dropped() const { return _events.dropped(); }
+
+	std::vector<Event> drain() { return _events.drain(); }
+
+private:
+
+	RingBuffer<Event> _events;
+	unsigned int _sampling;
+	uint64_t _pops;
+	std::chrono::steady_clock::time_point _start;
+};
+
+class WaterzContext {
+
+public:
+
+	typedef ContextRegistry<WaterzContext>::Handle Handle;
+
+	/**
+	 * Create a new context and return a handle to it.
+	 */
+	static Handle createNew() {
+
+		int id = _contexts.add(new WaterzContext());
+
+		Handle context = _contexts.get(id);
+		context->id = id;
+
+		return context;
 	}
 
-	static void free(int id) {
+	/**
+	 * Get a handle to the context with the given ID. The context stays valid 
+	 * as long as the handle exists, even if it gets freed concurrently. 
+	 * Returns an empty handle, if the context does not exist.
+	 */
+	static Handle get(int id) {
 
-		WaterzContext* context = get(id);
+		return _contexts.get(id);
+	}
 
-		if (context) {
+	/**
+	 * Free the context with the given ID, as soon as no handle to it exists 
+	 * anymore.
+	 */
+	static void free(int id) {
 
-			_contexts.erase(id);
-			delete context;
-		}
+		_contexts.remove(id);
 	}
 
 	int id;
 
+	// serializes calls on the same context from different threads
+	std::mutex mutex;
+
 	std::shared_ptr<RegionGraphType> regionGraph;
 	std::shared_ptr<RegionMergingType> regionMerging;
 	std::shared_ptr<ScoringFunctionType> scoringFunction;
 	std::shared_ptr<StatisticsProviderType> statisticsProvider;
 	volume_ref_ptr<SegID> segmentation;
-	volume_const_ref_ptr<GtID> groundtruth;
+	std::shared_ptr<ContingencyTableType> contingencyTable;
+	std::shared_ptr<EventLog> eventLog;
+
+	// merge in parallel batches of this size in mergeUntil(), 0 to merge 
+	// edges one by one
+	std::size_t mergeBatchSize;
 
 private:
 
-	WaterzContext() {}
+	friend class ContextRegistry<WaterzContext>;
+
+	WaterzContext() : mergeBatchSize(0) {}
 
 	~WaterzContext() {}
 
-	static std::map<int, WaterzContext*> _contexts;
-	static int _nextId;
+	// contexts can be created, used, and freed concurrently from several 
+	// threads
+	static ContextRegistry<WaterzContext> _contexts;
 };
 
+/**
+ * Configure a statistics provider for a scoring expression. Only 
+ * ExpressionScore supports expressions, for all other scoring functions the 
+ * expression has to be empty.
+ */
+template <typename ProviderType>
+void configureScoringExpression(ProviderType&, const ScoringExpression& expression) {
+
+	if (!expression.string().empty())
+		throw std::invalid_argument(
+				"a scoring expression was given, but the scoring function is "
+				"not ExpressionScore");
+}
+
+template <typename RegionGraphType, typename Precision>
+void configureScoringExpression(
+		ExpressionStatisticsProvider<RegionGraphType, Precision>& provider,
+		const ScoringExpression& expression) {
+
+	if (expression.string().empty())
+		throw std::invalid_argument("ExpressionScore requires a scoring expression");
+
+	provider.configure(expression);
+}
+
 class RegionMergingVisitor {
 
 public:
@@ -122,7 +337,9 @@ public:
 
 	void onStaleEdgeFound(RegionGraphType::EdgeIdType e, ScoreValue oldScore, ScoreValue newScore) {}
 
-	void onMerge(SegID a, SegID b, SegID c, ScoreValue score) {}
+	void onPutBack(RegionGraphType::EdgeIdType e, ScoreValue score) {}
+
+	void onMerge(RegionGraphType::EdgeIdType e, SegID a, SegID b, SegID c, ScoreValue score) {}
 };
 
 class MergeHistoryVisitor : public RegionMergingVisitor {
@@ -131,7 +348,7 @@ public:
 
 	MergeHistoryVisitor(std::vector<Merge>& history) : _history(history) {}
 
-	void onMerge(SegID a, SegID b, SegID c, ScoreValue score) {
+	void onMerge(RegionGraphType::EdgeIdType e, SegID a, SegID b, SegID c, ScoreValue score) {
 
 		_history.push_back({a, b, c, score});
 	}
@@ -141,6 +358,255 @@ private:
 	std::vector<Merge>& _history;
 };
 
+/**
+ * Keeps a contingency table up-to-date with the merges, if one is given.
+ */
+class ContingencyTableVisitor : public RegionMergingVisitor {
+
+public:
+
+	ContingencyTableVisitor(ContingencyTableType* contingencyTable) : _contingencyTable(contingencyTable) {}
+
+	void onMerge(RegionGraphType::EdgeIdType e, SegID a, SegID b, SegID c, ScoreValue score) {
+
+		if (!_contingencyTable)
+			return;
+
+		if (a != c)
+			_contingencyTable->merge(a, c);
+		if (b != c)
+			_contingencyTable->merge(b, c);
+	}
+
+private:
+
+	ContingencyTableType* _contingencyTable;
+};
+
+/**
+ * Records the metrics of the contingency table after each merge.
+ */
+class MergeCurveVisitor : public RegionMergingVisitor {
+
+public:
+
+	MergeCurveVisitor(
+			const ContingencyTableType& contingencyTable,
+			std::vector<MergeCurvePoint>& curve) :
+		_contingencyTable(contingencyTable),
+		_curve(curve) {}
+
+	void onMerge(RegionGraphType::EdgeIdType e, SegID a, SegID b, SegID c, ScoreValue score) {
+
+		auto m = _contingencyTable.metrics();
+
+		MergeCurvePoint point;
+		point.score              = score;
+		point.metrics.rand_split = std::get<0>(m);
+		point.metrics.rand_merge = std::get<1>(m);
+		point.metrics.voi_split  = std::get<2>(m);
+		point.metrics.voi_merge  = std::get<3>(m);
+
+		_curve.push_back(point);
+	}
+
+private:
+
+	const ContingencyTableType& _contingencyTable;
+	std::vector<MergeCurvePoint>& _curve;
+};
+
+/**
+ * Records the merges in a merge tree, with monotone merge levels.
+ */
+class MergeTreeVisitor : public RegionMergingVisitor {
+
+public:
+
+	MergeTreeVisitor(MergeTree<SegID, ScoreValue>& mergeTree) :
+		_mergeTree(mergeTree),
+		_level(std::numeric_limits<ScoreValue>::lowest()) {}
+
+	void onPop(RegionGraphType::EdgeIdType e, ScoreValue score) {
+
+		// merging stops at the first popped score that exceeds the threshold, 
+		// including scores of stale and deleted edges
+		_level = std::max(_level, score);
+	}
+
+	void onMerge(RegionGraphType::EdgeIdType e, SegID a, SegID b, SegID c, ScoreValue score) {
+
+		_mergeTree.merge((a == c ? b : a), c, _level);
+	}
+
+private:
+
+	MergeTree<SegID, ScoreValue>& _mergeTree;
+	ScoreValue _level;
+};
+
+/**
+ * Counts the events during merging.
+ */
+class CountingVisitor : public RegionMergingVisitor {
+
+public:
+
+	CountingVisitor(const RegionMergingType& regionMerging, Counters& counters) :
+		_regionMerging(regionMerging),
+		_counters(counters) {}
+
+	void onPop(RegionGraphType::EdgeIdType e, ScoreValue score) {
+
+		_counters.pops++;
+
+		// the queue is largest right before a pop
+		_counters.peak_queue_size = std::max(
+				_counters.peak_queue_size,
+				_regionMerging.queueSize() + 1);
+	}
+
+	void onDeletedEdgeFound(RegionGraphType::EdgeIdType e) {
+
+		_counters.deleted++;
+	}
+
+	void onStaleEdgeFound(RegionGraphType::EdgeIdType e, ScoreValue oldScore, ScoreValue newScore) {
+
+		_counters.stale++;
+	}
+
+	void onMerge(RegionGraphType::EdgeIdType e, SegID a, SegID b, SegID c, ScoreValue score) {
+
+		_counters.merges++;
+	}
+
+private:
+
+	const RegionMergingType& _regionMerging;
+	Counters& _counters;
+};
+
+/**
+ * Writes the events of the merge loop to an event log, if one is given.
+ */
+class EventLogVisitor : public RegionMergingVisitor {
+
+public:
+
+	EventLogVisitor(EventLog* eventLog) :
+		_eventLog(eventLog),
+		_sampled(false) {}
+
+	void onPop(RegionGraphType::EdgeIdType e, ScoreValue score) {
+
+		if (!_eventLog)
+			return;
+
+		_eventLog->countPop();
+		_score = score;
+		_sampled = _eventLog->sampled(e);
+	}
+
+	void onDeletedEdgeFound(RegionGraphType::EdgeIdType e) {
+
+		if (_sampled)
+			_eventLog->record(DeletedEdgeEvent, e, _score, _score);
+	}
+
+	void onStaleEdgeFound(RegionGraphType::EdgeIdType e, ScoreValue oldScore, ScoreValue newScore) {
+
+		if (_sampled)
+			_eventLog->record(StaleEdgeEvent, e, oldScore, newScore);
+	}
+
+	void onPutBack(RegionGraphType::EdgeIdType e, ScoreValue score) {
+
+		// reported after later pops, see onMerge()
+		if (_eventLog && _eventLog->sampled(e))
+			_eventLog->record(PutBackEdgeEvent, e, score, score);
+	}
+
+	void onMerge(RegionGraphType::EdgeIdType e, SegID a, SegID b, SegID c, ScoreValue score) {
+
+		// b got merged into c, merges can be reported after later pops (see 
+		// IterativeRegionMerging::mergeUntilInBatches())
+		if (_eventLog && _eventLog->sampled(e))
+			_eventLog->record(MergeEvent, e, score, score, c, (b == c ? a : b));
+	}
+
+private:
+
+	EventLog* _eventLog;
+
+	// the score of the last popped edge
+	ScoreValue _score;
+	bool _sampled;
+};
+
+/**
+ * Forwards all callbacks to two visitors.
+ */
+template <typename Visitor1, typename Visitor2>
+class CompoundVisitor {
+
+public:
+
+	CompoundVisitor(Visitor1& visitor1, Visitor2& visitor2) :
+		_visitor1(visitor1),
+		_visitor2(visitor2) {}
+
+	void onPop(RegionGraphType::EdgeIdType e, ScoreValue score) {
+
+		_visitor1.onPop(e, score);
+		_visitor2.onPop(e, score);
+	}
+
+	void onDeletedEdgeFound(RegionGraphType::EdgeIdType e) {
+
+		_visitor1.onDeletedEdgeFound(e);
+		_visitor2.onDeletedEdgeFound(e);
+	}
+
+	void onStaleEdgeFound(RegionGraphType::EdgeIdType e, ScoreValue oldScore, ScoreValue newScore) {
+
+		_visitor1.onStaleEdgeFound(e, oldScore, newScore);
+		_visitor2.onStaleEdgeFound(e, oldScore, newScore);
+	}
+
+	void onPutBack(RegionGraphType::EdgeIdType e, ScoreValue score) {
+
+		_visitor1.onPutBack(e, score);
+		_visitor2.onPutBack(e, score);
+	}
+
+	void onMerge(RegionGraphType::EdgeIdType e, SegID a, SegID b, SegID c, ScoreValue score) {
+
+		_visitor1.onMerge(e, a, b, c, score);
+		_visitor2.onMerge(e, a, b, c, score);
+	}
+
+private:
+
+	Visitor1& _visitor1;
+	Visitor2& _visitor2;
+};
+
+/**
+ * Extract fragments (if findFragments), the region graph, and its statistics 
+ * from affinities.
+ *
+ * If preMergeThreshold is finite, all edges with an initial score below it 
+ * are merged at once before iterative merging (see preMerge()), and the 
+ * segmentation is relabelled accordingly.
+ *
+ * If fragmentSizeThreshold is non-zero, fragments found by the watershed that 
+ * are smaller than it are merged into their neighbors before the region graph 
+ * is extracted (see merge_small_fragments()).
+ *
+ * If fragmentsInXy, the watershed is performed on each z-slice independently 
+ * (see watershed_2d()).
+ */
 WaterzState initialize(
 		size_t          width,
 		size_t          height,
@@ -150,14 +616,113 @@ WaterzState initialize(
 		const GtID*     groundtruth_data = NULL,
 		AffValue        affThresholdLow  = 0.0001,
 		AffValue        affThresholdHigh = 0.9999,
-		bool            findFragments = true);
+		bool            findFragments = true,
+		const std::string& scoringExpression = "",
+		ScoreValue      preMergeThreshold = -std::numeric_limits<ScoreValue>::infinity(),
+		std::size_t     fragmentSizeThreshold = 0,
+		AffValue        fragmentAffThreshold = 0,
+		bool            fragmentsInXy = false);
+
+/**
+ * Initialize agglomeration from a precomputed region graph, without voxel 
+ * data.
+ *
+ * @param numNodes [in]
+ *              The number of nodes, node IDs are 0 to numNodes-1.
+ * @param edges [in]
+ *              numEdges pairs (u, v) of node IDs, each edge given once.
+ * @param seeds [in]
+ *              The statistics needed by the scoring function (numNodes and 
+ *              numEdges are set by this function).
+ * @param labels_data [out]
+ *              An array of numNodes labels, takes the place of the 
+ *              segmentation: mergeUntil() stores the segment of each node 
+ *              in it.
+ */
+WaterzState initializeFromRegionGraph(
+		std::size_t                numNodes,
+		std::size_t                numEdges,
+		const SegID*               edges,
+		const StatisticsSeedsType& seeds,
+		SegID*                     labels_data,
+		const std::string&         scoringExpression = "");
 
 std::vector<Merge> mergeUntil(
 		WaterzState& state,
 		float        threshold);
 
+/**
+ * Merge until the given threshold and record the metrics after each merge.
+ * Requires that a ground-truth was given to initialize().
+ */
+std::vector<MergeCurvePoint> getMergeCurve(
+		WaterzState& state,
+		float        threshold);
+
 std::vector<ScoredEdge> getRegionGraph(WaterzState& state);
 
+/**
+ * Merge until all regions are merged and get the merge tree, with one node 
+ * for each initial region. Merges performed before are not part of the tree.  
+ * Does not change the segmentation.
+ */
+std::vector<MergeTreeNode> getMergeTree(WaterzState& state);
+
 void free(WaterzState& state);
 
+/**
+ * Write the state of agglomeration (segmentation, region graph, statistics, 
+ * queue, and merge-tree) to a file, such that merging can be resumed with 
+ * resume(). The file is replaced atomically. The ground-truth, metrics, and 
+ * the event log are not saved.
+ *
+ * info is stored uncompressed right after the magic number and version, such 
+ * that callers can identify the module needed to resume without loading it.
+ */
+void saveState(
+		WaterzState&       state,
+		const std::string& path,
+		const std::string& info = "");
+
+/**
+ * Get the shape of the segmentation volume in a file written by saveState().
+ */
+std::vector<std::size_t> getSavedShape(const std::string& path);
+
+/**
+ * Create a new context from a file written by saveState(). The saved 
+ * segmentation is copied into segmentation_data, which has to be of the shape 
+ * returned by getSavedShape(). Throws std::runtime_error, if the file was 
+ * written with a different scoring function or queue, or is corrupt.
+ */
+WaterzState resumeState(
+		const std::string& path,
+		SegID*             segmentation_data);
+
+/**
+ * Record the events of the following calls to mergeUntil() and 
+ * getMergeCurve() in a ring buffer of the given capacity, sampling every 
+ * sampling-th edge. A capacity of 0 disables the event log.
+ */
+void setEventLog(
+		WaterzState& state,
+		std::size_t  capacity,
+		unsigned int sampling);
+
+/**
+ * Merge independent edges of batches of the given size in parallel in the 
+ * following calls to mergeUntil() (see 
+ * IterativeRegionMerging::mergeUntilInBatches()). A size of 0 merges edges 
+ * one by one.
+ */
+void setMergeBatchSize(
+		WaterzState& state,
+		std::size_t  batchSize);
+
+/**
+ * Get the events recorded since the last call, oldest first. Events that did 
+ * not fit into the ring buffer are counted in state.counters.dropped_events.
+ */
+std::vector<Event> getEventLog(WaterzState& state);
+
 #endif
@@ -0,0 +1,22 @@
+#include "frontend_cut.h"
+#include "MergeTree.hpp"
+
+void
+cut_merge_tree(
+		const SegID*      parents,
+		const ScoreValue* scores,
+		std::size_t       numNodes,
+		ScoreValue        threshold,
+		const SegID*      fragments_data,
+		SegID*            segmentation_data,
+		std::size_t       numVoxels) {
+
+	cutMergeTree(
+			parents,
+			scores,
+			numNodes,
+			threshold,
+			fragments_data,
+			segmentation_data,
+			numVoxels);
+}
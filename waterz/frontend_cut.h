@@ -0,0 +1,20 @@
+#ifndef C_CUT_H
+#define C_CUT_H
+
+#include <cstddef>
+#include <cstdint>
+
+typedef uint64_t SegID;
+typedef float ScoreValue;
+
+void
+cut_merge_tree(
+		const SegID*      parents,
+		const ScoreValue* scores,
+		std::size_t       numNodes,
+		ScoreValue        threshold,
+		const SegID*      fragments_data,
+		SegID*            segmentation_data,
+		std::size_t       numVoxels);
+
+#endif
@@ -2,6 +2,7 @@
 #define C_EVALUATE_H
 
 #include "backend/types.hpp"
+#include "backend/Logging.hpp"
 
 typedef uint64_t SegID;
 
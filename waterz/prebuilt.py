@@ -0,0 +1,107 @@
+'''
+Scoring functions and queues that are compiled into the package at install
+time. agglomerate() uses these modules directly, and only compiles a module at
+runtime for other scoring functions.
+
+This file is also read by setup.py, it should therefore not import anything
+from waterz.
+'''
+
+# (name, scoring function) of the prebuilt scoring functions
+SCORING_FUNCTIONS = [
+    (
+        'mean',
+        'OneMinus<MeanAffinity<RegionGraphType, ScoreValue>>'
+    ),
+    (
+        'max',
+        'OneMinus<MaxAffinity<RegionGraphType, ScoreValue>>'
+    ),
+    (
+        'quantile50',
+        'OneMinus<HistogramQuantileAffinity<RegionGraphType, 50, ScoreValue, 256>>'
+    ),
+    (
+        'quantile75',
+        'OneMinus<HistogramQuantileAffinity<RegionGraphType, 75, ScoreValue, 256>>'
+    ),
+    (
+        'quantile90',
+        'OneMinus<HistogramQuantileAffinity<RegionGraphType, 90, ScoreValue, 256>>'
+    ),
+    (
+        'meanmax10',
+        'OneMinus<MeanMaxKAffinity<RegionGraphType, 10, ScoreValue>>'
+    ),
+    (
+        'expression',
+        'ExpressionScore<RegionGraphType, ScoreValue>'
+    ),
+    (
+        'mean_minsize',
+        'Multiply<OneMinus<MeanAffinity<RegionGraphType, ScoreValue>>, MinSize<RegionGraphType>>'
+    ),
+    (
+        'quantile75_minsize',
+        'Multiply<OneMinus<HistogramQuantileAffinity<RegionGraphType, 75, ScoreValue, 256>>, MinSize<RegionGraphType>>'
+    ),
+]
+
+# (name, discretize_queue) of the prebuilt queues
+QUEUES = [
+    ('pq', 0),
+    ('bq256', 256),
+]
+
+
+def normalize(scoring_function):
+    '''Remove all whitespace from a scoring function string.'''
+
+    return ''.join(scoring_function.split())
+
+
+def scoring_function_header(scoring_function):
+    '''Content of ScoringFunction.h for the given scoring function.'''
+
+    return 'typedef %s ScoringFunctionType;' % scoring_function
+
+
+def queue_header(discretize_queue):
+    '''Content of Queue.h for the given discretize_queue.'''
+
+    if discretize_queue == 0:
+        return 'template<typename T, typename S> using QueueType = PriorityQueue<T, S>;'
+    else:
+        return 'template<typename T, typename S> using QueueType = BinQueue<T, S, %d>;' % discretize_queue
+
+
+def variants():
+    '''
+    Get a list of (module name, scoring function, discretize_queue) of all
+    prebuilt variants.
+    '''
+
+    return [
+        (
+            '_agglomerate_%s_%s' % (function_name, queue_name),
+            scoring_function,
+            discretize_queue
+        )
+        for function_name, scoring_function in SCORING_FUNCTIONS
+        for queue_name, discretize_queue in QUEUES
+    ]
+
+
+def module_name(scoring_function, discretize_queue):
+    '''
+    Get the name of the prebuilt module (relative to the waterz package) for
+    the given scoring function and queue, or None if there is none.
+    '''
+
+    scoring_function = normalize(scoring_function)
+
+    for name, function, queue in variants():
+        if normalize(function) == scoring_function and queue == discretize_queue:
+            return name
+
+    return None
@@ -0,0 +1,170 @@
+'''
+Analysis of the event logs returned by agglomerate(..., return_event_log=True).
+
+Each event corresponds to one edge taken from the queue, and tells what
+happened to it:
+
+    DELETED   the edge got deleted by a previous merge and is discarded
+    STALE     the score of the edge changed, it was re-scored and put back
+    MERGE     the edge was merged
+    PUT_BACK  the edge was put back with its score unchanged, because it was
+              not selected for a batch of merges (merge_batch_size)
+
+Events of a batch are recorded when the batch is merged, i.e., after all of
+its edges were popped. MERGE and PUT_BACK events therefore have the number of
+pops and the timestamp of the end of their batch.
+
+Example::
+
+    for segmentation, events in waterz.agglomerate(
+            affs, [0.5], return_event_log=True):
+
+        print(waterz.profiling.histograms(events))
+'''
+
+import numpy as np
+
+DELETED = 0
+STALE = 1
+MERGE = 2
+PUT_BACK = 3
+
+
+def _by_edge(events):
+    '''Sort events by edge, and by time for each edge.'''
+
+    order = np.lexsort((events['pop'], events['edge']))
+    events = events[order]
+
+    first_of_edge = np.ones(len(events), dtype=bool)
+    first_of_edge[1:] = events['edge'][1:] != events['edge'][:-1]
+
+    return events, first_of_edge
+
+
+def stale_chain_lengths(events):
+    '''
+    Get the number of consecutive re-scorings of an edge before it got merged
+    or deleted (or the log ended).
+
+    Long chains indicate that the scores of an edge keep increasing in small
+    steps, such that the edge is popped over and over again. Edges put back
+    unchanged (PUT_BACK) do not end or extend a chain.
+    '''
+
+    events = events[events['type'] != PUT_BACK]
+
+    if len(events) == 0:
+        return np.zeros((0,), dtype=np.int64)
+
+    events, first_of_edge = _by_edge(events)
+
+    stale = events['type'] == STALE
+    last_of_edge = np.ones(len(events), dtype=bool)
+    last_of_edge[:-1] = first_of_edge[1:]
+
+    # a chain ends with the first non-stale event, or the last event of an
+    # edge
+    end = ~stale | last_of_edge
+    chain = np.concatenate([[0], np.cumsum(end)[:-1]])
+
+    return np.bincount(
+        chain,
+        weights=stale,
+        minlength=np.count_nonzero(end)).astype(np.int64)
+
+
+def queue_dwell_times(events, unit='pops'):
+    '''
+    Get the time each edge spent in the queue before it was popped.
+
+    Edges are (re-)inserted into the queue when they are re-scored, or put
+    back after they were not selected for a batch of merges. For the first
+    event of an edge, the time is measured from the start of the log, which is
+    exact for edges that were in the queue when logging started. With
+    merge_batch_size, times are measured from and to the end of batches, see
+    above.
+
+    Parameters
+    ----------
+
+        unit: 'pops' or 'ns'
+
+            Measure time in number of pops (independent of the machine) or
+            in nanoseconds.
+    '''
+
+    if unit not in ('pops', 'ns'):
+        raise ValueError("unit has to be 'pops' or 'ns'")
+
+    if len(events) == 0:
+        return np.zeros((0,), dtype=np.uint64)
+
+    events, first_of_edge = _by_edge(events)
+
+    times = events['pop'] if unit == 'pops' else events['timestamp']
+    pushed = np.zeros_like(times)
+    pushed[1:] = times[:-1]
+    pushed[first_of_edge] = 0
+
+    return times - pushed
+
+
+def merge_degrees(events):
+    '''
+    Get the number of merges of each region that absorbed other regions.
+
+    A few regions with very high degrees indicate that merging grows a few
+    large regions. If the scoring function depends on statistics of regions
+    (like their size), each merge increases the version of such a region,
+    which makes all of its incident edges stale at once, such that each of
+    them is re-scored when it is popped.
+    '''
+
+    merges = events[events['type'] == MERGE]
+    if len(merges) == 0:
+        return np.zeros((0,), dtype=np.int64)
+
+    _, counts = np.unique(merges['a'], return_counts=True)
+
+    return counts
+
+
+def histograms(events):
+    '''
+    Summarize an event log in histograms.
+
+    Returns a dictionary with
+
+        'stale_chain_lengths'
+
+            counts[i] is the number of chains of i re-scorings,
+
+        'merge_degrees'
+
+            counts[i] is the number of regions with i merges,
+
+        'queue_dwell_pops'
+
+            counts[i] is the number of pops with a dwell time in
+            [2^i - 1, 2^(i+1) - 1) pops,
+
+        'events'
+
+            the number of DELETED, STALE, MERGE, and PUT_BACK events.
+    '''
+
+    dwell = queue_dwell_times(events, unit='pops')
+
+    return {
+        'stale_chain_lengths': np.bincount(stale_chain_lengths(events)),
+        'merge_degrees': np.bincount(merge_degrees(events)),
+        'queue_dwell_pops': np.bincount(
+            np.floor(np.log2(dwell.astype(np.float64) + 1)).astype(np.int64)),
+        'events': {
+            'deleted': int(np.count_nonzero(events['type'] == DELETED)),
+            'stale': int(np.count_nonzero(events['type'] == STALE)),
+            'merge': int(np.count_nonzero(events['type'] == MERGE)),
+            'put_back': int(np.count_nonzero(events['type'] == PUT_BACK)),
+        }
+    }